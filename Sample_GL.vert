@@ -4,7 +4,17 @@
 layout (location = 0) in vec3 vertexPosition;
 layout (location = 1) in vec3 vertexColor;
 
-uniform mat4 MVP;
+// view-projection, shared by all programs and updated only when the camera changes
+layout (std140) uniform Camera {
+    mat4 VP;
+};
+// model matrices of every object drawn this frame, and which one the draw's
+// first instance uses (a constant attribute), the next instances take the
+// following ones; the size must match MAX_FRAME_OBJECTS in assgn1.cpp
+layout (std140) uniform Objects {
+    mat4 M[256];
+};
+layout (location = 4) in uint objectIndex;
 
 // output data : used by fragment shader
 out vec3 fragColor;
@@ -17,6 +27,6 @@ void main ()
     // to produce the color of each fragment
     fragColor = vertexColor;
 
-    // Output position of the vertex, in clip space : MVP * position
-    gl_Position = MVP * v;
+    // Output position of the vertex, in clip space : VP * M * position
+    gl_Position = VP * (M[objectIndex + uint(gl_InstanceID)] * v);
 }
@@ -0,0 +1,31 @@
+#version 330 core
+
+// input data : shared mesh, one copy drawn per instance
+layout (location = 0) in vec3 vertexPosition;
+
+// per-instance data : x, y translation and rotation (degrees) about z, color
+layout (location = 2) in vec3 instanceTransform;
+layout (location = 3) in vec3 instanceColor;
+
+// view-projection, shared by all programs and updated only when the camera changes
+layout (std140) uniform Camera {
+    mat4 VP;
+};
+
+// output data : used by fragment shader
+out vec3 fragColor;
+
+void main ()
+{
+    float angle = radians(instanceTransform.z);
+    float c = cos(angle);
+    float s = sin(angle);
+
+    // Model transform = translate * rotate, built here instead of on the CPU
+    vec2 p = vec2(c*vertexPosition.x - s*vertexPosition.y, s*vertexPosition.x + c*vertexPosition.y);
+    vec4 v = vec4(p + instanceTransform.xy, vertexPosition.z, 1);
+
+    fragColor = instanceColor;
+
+    gl_Position = VP * v;
+}
@@ -1,11 +1,18 @@
+#include <algorithm>
 #include <iostream>
 #include <cmath>
 #include <fstream>
+#include <mutex>
+#include <sstream>
 #include <vector>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <cstdlib>
 #include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <time.h>
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
@@ -14,55 +21,104 @@
 #include <glm/glm.hpp>
 #include <glm/gtx/transform.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include "game.h"
+#include "replay.h"
+#include "profiler.h"
+#include "logger.h"
+#include "stream_buffer.h"
+#include "particles.h"
+#include "shader_cache.h"
+#include "shader_watch.h"
+#include "offscreen.h"
+#include "frame_capture.h"
+#include "image_diff.h"
+#include "block_kernel.h"
+#include "jobs.h"
+#include "render_commands.h"
+#include "render_thread.h"
+#include "gl_state.h"
 using namespace std;
 
+/* A mesh: a range of vertices inside the shared mesh buffer (see Meshes) */
 struct VAO {
   GLuint VertexArrayID;
   GLuint VertexBuffer;
-  GLuint ColorBuffer;
 
   GLenum PrimitiveMode;
   GLenum FillMode;
+  int FirstVertex;   // base vertex of this mesh in the shared buffer
   int NumVertices;
 };
 typedef struct VAO VAO;
 
-struct GLMatrices {
-	glm::mat4 projection;
-	glm::mat4 model;
-	glm::mat4 view;
-	GLuint MatrixID;
-  } Matrices;
+/* All static meshes live in one interleaved x,y,z,r,g,b vertex buffer with a
+   single VAO, so drawing any of them needs no VAO or VBO rebinding */
+const int MESH_VERTEX_FLOATS = 6;
+
+struct MeshRegistry {
+  GLuint VertexArrayID;
+  GLuint VertexBuffer;
+  std::vector<GLfloat> vertices;   // CPU copy, uploaded by uploadMeshes()
+} Meshes;
+
+/* Everything rewritten each frame (block instances, object transforms) is
+   written into this triple-buffered buffer instead of its own VBO */
+const GLsizeiptr STREAM_REGION_SIZE = 64*1024;
+StreamBuffer Stream;
+
+/* The camera's view-projection matrix lives in a uniform buffer bound to
+   the "Camera" block of every program. It is recomputed and uploaded only
+   when the projection (window reshape) or the view changes, so drawing an
+   object costs one model matrix upload and no CPU matrix products. */
+const GLuint CAMERA_BLOCK_BINDING = 0;
+
+struct Camera {
+  glm::vec3 eye, target, up;
+  glm::mat4 view;
+  glm::mat4 projection;
+  glm::mat4 VP;
+  GLuint UniformBuffer;
+  bool dirty;
+  int viewport_width, viewport_height;   // as last set with glViewport
+} camera;
 
   GLuint programID;
+  GLuint instancedProgramID;
 
-  /* Function to load Shaders - Use it as it is */
-  GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path) {
+  /* Programs as numbered in render command keys */
+  enum RenderProgram {
+    PROGRAM_OBJECTS,     // programID
+    PROGRAM_INSTANCED    // instancedProgramID
+  };
 
-   // Create the shaders
-   GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-   GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
+  /* Where linked programs are cached between launches, NULL for no cache */
+  const char* shader_cache_dir = SHADER_CACHE_DIR;
 
-   // Read the Vertex Shader code from the file
-   std::string VertexShaderCode;
-   std::ifstream VertexShaderStream(vertex_file_path, std::ios::in);
-   if(VertexShaderStream.is_open())
-   {
-    std::string Line = "";
-    while(getline(VertexShaderStream, Line))
-    VertexShaderCode += "\n" + Line;
-    VertexShaderStream.close();
+  /* Whole file in one read, empty if it cannot be opened */
+  std::string readShaderFile(const char * file_path) {
+   std::ifstream Stream(file_path, std::ios::in | std::ios::binary);
+   std::stringstream Code;
+   Code << Stream.rdbuf();
+   return Code.str();
   }
 
-  // Read the Fragment Shader code from the file
-  std::string FragmentShaderCode;
-  std::ifstream FragmentShaderStream(fragment_file_path, std::ios::in);
-  if(FragmentShaderStream.is_open()){
-    std::string Line = "";
-    while(getline(FragmentShaderStream, Line))
-    FragmentShaderCode += "\n" + Line;
-    FragmentShaderStream.close();
-  }
+  /* Build a program from shader sources (the paths are only for messages).
+     Returns 0 if it does not compile or link. */
+  GLuint BuildProgram(const std::string& VertexShaderCode, const std::string& FragmentShaderCode,
+                      const char * vertex_file_path, const char * fragment_file_path) {
+
+   // Unchanged sources on the same driver: reuse the program linked by an
+   // earlier launch instead of compiling
+   uint64_t CacheKey = programCacheKey(VertexShaderCode, FragmentShaderCode);
+   GLuint CachedProgramID = loadCachedProgram(CacheKey);
+   if (CachedProgramID) {
+    printf("Loaded cached program : %s + %s\n", vertex_file_path, fragment_file_path);
+    return CachedProgramID;
+   }
+
+   // Create the shaders
+   GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
+   GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
 
   GLint Result = GL_FALSE;
   int InfoLogLength;
@@ -98,6 +154,8 @@ struct GLMatrices {
   GLuint ProgramID = glCreateProgram();
   glAttachShader(ProgramID, VertexShaderID);
   glAttachShader(ProgramID, FragmentShaderID);
+  if (shaderCacheEnabled())
+    glProgramParameteri(ProgramID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
   glLinkProgram(ProgramID);
 
   // Check the program
@@ -106,100 +164,191 @@ struct GLMatrices {
   std::vector<char> ProgramErrorMessage( max(InfoLogLength, int(1)) );
   glGetProgramInfoLog(ProgramID, InfoLogLength, NULL, &ProgramErrorMessage[0]);
   fprintf(stdout, "%s\n", &ProgramErrorMessage[0]);
+  if (Result == GL_TRUE)
+    storeCachedProgram(CacheKey, ProgramID);
 
   glDeleteShader(VertexShaderID);
   glDeleteShader(FragmentShaderID);
 
+  if (Result != GL_TRUE) {
+    glDeleteProgram(ProgramID);
+    return 0;
+  }
   return ProgramID;
 }
 
+  /* Function to load Shaders - Use it as it is */
+  GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path) {
+   return BuildProgram(readShaderFile(vertex_file_path), readShaderFile(fragment_file_path),
+                       vertex_file_path, fragment_file_path);
+  }
+
 static void error_callback(int error, const char* description)
 {
   fprintf(stderr, "Error: %s\n", description);
 }
 
+/* Ask the main loop to stop; it finishes the replay and profile files and
+   tears the window down itself */
 void quit(GLFWwindow *window)
 {
-  glfwDestroyWindow(window);
-  glfwTerminate();
+  glfwSetWindowShouldClose(window, 1);
   //    exit(EXIT_SUCCESS);
 }
 
 
-/* Generate VAO, VBOs and return VAO handle */
-struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat* color_buffer_data, GLenum fill_mode=GL_FILL)
+/* Create the shared mesh VAO and VBO names, before any mesh is added */
+void initMeshRegistry ()
 {
-  struct VAO* vao = new struct VAO;
-  vao->PrimitiveMode = primitive_mode;
-  vao->NumVertices = numVertices;
-  vao->FillMode = fill_mode;
-
-  // Create Vertex Array Object
   // Should be done after CreateWindow and before any other GL calls
-  glGenVertexArrays(1, &(vao->VertexArrayID)); // VAO
-  glGenBuffers (1, &(vao->VertexBuffer)); // VBO - vertices
-  glGenBuffers (1, &(vao->ColorBuffer));  // VBO - colors
+  glGenVertexArrays(1, &(Meshes.VertexArrayID));
+  glGenBuffers (1, &(Meshes.VertexBuffer));
+  Meshes.vertices.clear();
+}
 
-  glBindVertexArray (vao->VertexArrayID); // Bind the VAO 
-  glBindBuffer (GL_ARRAY_BUFFER, vao->VertexBuffer); // Bind the VBO vertices 
-  glBufferData (GL_ARRAY_BUFFER, 3*numVertices*sizeof(GLfloat), vertex_buffer_data, GL_STATIC_DRAW); // Copy the vertices into VBO
+/* Copy every registered mesh into the shared VBO, in one upload */
+void uploadMeshes ()
+{
+  bindVertexArray (Meshes.VertexArrayID);
+  bindBuffer (GL_ARRAY_BUFFER, Meshes.VertexBuffer);
+  glBufferData (GL_ARRAY_BUFFER, Meshes.vertices.size()*sizeof(GLfloat), Meshes.vertices.data(), GL_STATIC_DRAW);
+
+  GLsizei stride = MESH_VERTEX_FLOATS*sizeof(GLfloat);
+  enableVertexAttrib(0);
   glVertexAttribPointer(
     0,                  // attribute 0. Vertices
     3,                  // size (x,y,z)
     GL_FLOAT,           // type
     GL_FALSE,           // normalized?
-    0,                  // stride
+    stride,             // stride
     (void*)0            // array buffer offset
     );
-
-  glBindBuffer (GL_ARRAY_BUFFER, vao->ColorBuffer); // Bind the VBO colors 
-  glBufferData (GL_ARRAY_BUFFER, 3*numVertices*sizeof(GLfloat), color_buffer_data, GL_STATIC_DRAW);  // Copy the vertex colors
+  enableVertexAttrib(1);
   glVertexAttribPointer(
     1,                  // attribute 1. Color
     3,                  // size (r,g,b)
     GL_FLOAT,           // type
     GL_FALSE,           // normalized?
-    0,                  // stride
-    (void*)0            // array buffer offset
+    stride,             // stride
+    (void*)(3*sizeof(GLfloat)) // array buffer offset
     );
+}
+
+/* Bind the shared mesh VAO; draw3DObject relies on it being bound */
+void bindMeshes ()
+{
+  bindVertexArray (Meshes.VertexArrayID);
+}
+
+/* Add a mesh to the shared buffer and return its handle */
+struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat* color_buffer_data, GLenum fill_mode=GL_FILL)
+{
+  struct VAO* vao = new struct VAO;
+  vao->PrimitiveMode = primitive_mode;
+  vao->NumVertices = numVertices;
+  vao->FillMode = fill_mode;
+  vao->VertexArrayID = Meshes.VertexArrayID;
+  vao->VertexBuffer = Meshes.VertexBuffer;
+  vao->FirstVertex = Meshes.vertices.size()/MESH_VERTEX_FLOATS;
+
+  // Interleave position and color of each vertex
+  for (int i=0; i<numVertices; i++) {
+    Meshes.vertices.insert(Meshes.vertices.end(), vertex_buffer_data + 3*i, vertex_buffer_data + 3*i + 3);
+    Meshes.vertices.insert(Meshes.vertices.end(), color_buffer_data + 3*i, color_buffer_data + 3*i + 3);
+  }
 
   return vao;
 }
 
-/* Generate VAO, VBOs and return VAO handle - Common Color for all vertices */
+/* Add a mesh to the shared buffer - Common Color for all vertices */
 struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat red, const GLfloat green, const GLfloat blue, GLenum fill_mode=GL_FILL)
 {
-  GLfloat* color_buffer_data = new GLfloat [3*numVertices];
+  std::vector<GLfloat> color_buffer_data (3*numVertices);
   for (int i=0; i<numVertices; i++) {
     color_buffer_data [3*i] = red;
     color_buffer_data [3*i + 1] = green;
     color_buffer_data [3*i + 2] = blue;
   }
 
-  return create3DObject(primitive_mode, numVertices, vertex_buffer_data, color_buffer_data, fill_mode);
+  return create3DObject(primitive_mode, numVertices, vertex_buffer_data, color_buffer_data.data(), fill_mode);
+}
+
+/* Number of a fill mode in render command keys */
+int fillModeIndex (GLenum mode)
+{
+  return mode == GL_FILL ? 0 : mode == GL_LINE ? 1 : 2;
 }
 
-/* Render the VBOs handled by VAO */
-void draw3DObject (struct VAO* vao)
+/* Render 'instances' copies of a mesh from the shared buffer (bindMeshes()
+   must have been called); gl_InstanceID tells them apart */
+void draw3DObject (struct VAO* vao, int instances=1)
 {
   // Change the Fill Mode for this object
-  glPolygonMode (GL_FRONT_AND_BACK, vao->FillMode);
+  setPolygonMode (vao->FillMode);
 
-  // Bind the VAO to use
-  glBindVertexArray (vao->VertexArrayID);
+  // Draw the geometry !
+  glDrawArraysInstanced(vao->PrimitiveMode, vao->FirstVertex, vao->NumVertices, instances);
+}
 
-  // Enable Vertex Attribute 0 - 3d Vertices
-  glEnableVertexAttribArray(0);
-  // Bind the VBO to use
-  glBindBuffer(GL_ARRAY_BUFFER, vao->VertexBuffer);
+/* Model transforms of the non-instanced objects of a frame. They are
+   collected by queueObject(), uploaded to a uniform buffer with a single
+   call and picked in Sample_GL.vert by an object index passed as a constant
+   vertex attribute, instead of one glUniformMatrix4fv per object. A run of
+   objects with the same mesh is one instanced draw, the shader adds
+   gl_InstanceID to the index.
+   MAX_FRAME_OBJECTS must match the array in Sample_GL.vert: 256 mat4 are
+   the 16KB every GL 3.3 implementation allows in a uniform block. */
+const int MAX_FRAME_OBJECTS = 256;
+const GLuint OBJECTS_BLOCK_BINDING = 1;
+const GLuint OBJECT_INDEX_ATTRIB = 4;
+
+struct ObjectQueue {
+  GLint UniformAlignment;   // GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+  std::vector<glm::mat4> transforms;
+  std::vector<struct VAO*> meshes;
+} Objects;
+
+void initObjectQueue ()
+{
+  glGetIntegerv (GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &Objects.UniformAlignment);
+  Objects.transforms.reserve(MAX_FRAME_OBJECTS);
+  Objects.meshes.reserve(MAX_FRAME_OBJECTS);
+}
 
-  // Enable Vertex Attribute 1 - Color
-  glEnableVertexAttribArray(1);
-  // Bind the VBO to use
-  glBindBuffer(GL_ARRAY_BUFFER, vao->ColorBuffer);
+/* Upload every queued transform at once, then draw the queued objects in
+   order with the plain program */
+void flushObjects ()
+{
+  if (Objects.meshes.empty())
+    return;
+  useProgram (programID);
+  bindMeshes ();
+  // The bound range must cover the whole block, even if only part is used
+  GLsizeiptr size = MAX_FRAME_OBJECTS*sizeof(glm::mat4);
+  GLintptr offset;
+  void* data = streamAlloc (Stream, size, Objects.UniformAlignment, &offset);
+  memcpy (data, &Objects.transforms[0][0][0], Objects.transforms.size()*sizeof(glm::mat4));
+  streamCommit (Stream);
+  bindBufferRange (GL_UNIFORM_BUFFER, OBJECTS_BLOCK_BINDING, Stream.Buffer, offset, size);
+  size_t i, run;
+  for (i=0;i<Objects.meshes.size();i+=run) {
+    for (run=1;i+run<Objects.meshes.size() && Objects.meshes[i+run]==Objects.meshes[i];run++)
+      ;
+    // The attribute array is disabled, so every vertex reads this constant
+    glVertexAttribI1ui (OBJECT_INDEX_ATTRIB, i);
+    draw3DObject (Objects.meshes[i], run);
+  }
+  Objects.transforms.clear();
+  Objects.meshes.clear();
+}
 
-  // Draw the geometry !
-  glDrawArrays(vao->PrimitiveMode, 0, vao->NumVertices); // Starting from vertex 0; 3 vertices total -> 1 triangle
+/* Draw 'vao' with the given model matrix at the next flushObjects() */
+void queueObject (struct VAO* vao, const glm::mat4& model)
+{
+  if (Objects.meshes.size() == (size_t)MAX_FRAME_OBJECTS)
+    flushObjects();
+  Objects.transforms.push_back(model);
+  Objects.meshes.push_back(vao);
 }
 
 /**************************
@@ -207,14 +356,8 @@ void draw3DObject (struct VAO* vao)
 **************************/
 
 float triangle_rot_dir = 1;
-float gun2_rot_dir_pos = 1;
-float gun2_rot_dir_neg = -1;
 bool triangle_rot_status = false;
 bool gun2_rot_status = false;
-float rect1_xpos = 1.4;
-float rect2_xpos = -1.4;
-float gun_ypos = -0.3;
-float increments = 6;
 /* Executed when a regular key is pressed/released/held-down */
 /* Prefered for Keyboard events */
 
@@ -233,19 +376,82 @@ void keyboardChar (GLFWwindow* window, unsigned int key)
 }
 /* Executed when a mouse button is pressed/released */
 
+void initCamera ()
+{
+  glGenBuffers (1, &camera.UniformBuffer);
+  bindBuffer (GL_UNIFORM_BUFFER, camera.UniformBuffer);
+  glBufferData (GL_UNIFORM_BUFFER, sizeof(glm::mat4), NULL, GL_DYNAMIC_DRAW);
+  bindBufferBase (GL_UNIFORM_BUFFER, CAMERA_BLOCK_BINDING, camera.UniformBuffer);
+  // Fixed camera for 2D (ortho) in XY plane
+  camera.eye = glm::vec3(0,0,3);
+  camera.target = glm::vec3(0,0,0);
+  camera.up = glm::vec3(0,1,0);
+  camera.dirty = true;
+  camera.viewport_width = camera.viewport_height = 0;
+}
+
+/* Point a program's uniform block, if it has one by that name, at a binding */
+void bindUniformBlock (GLuint program, const char* name, GLuint binding)
+{
+  GLuint index = glGetUniformBlockIndex(program, name);
+  if (index != GL_INVALID_INDEX)
+    glUniformBlockBinding(program, index, binding);
+}
+
+void setCameraProjection (const glm::mat4& projection)
+{
+  camera.projection = projection;
+  camera.dirty = true;
+}
+
+void setCameraView (glm::vec3 eye, glm::vec3 target, glm::vec3 up)
+{
+  camera.eye = eye;
+  camera.target = target;
+  camera.up = up;
+  camera.dirty = true;
+}
+
+/* Recompute and upload VP if the camera changed since the last frame */
+void updateCamera ()
+{
+  if (!camera.dirty)
+    return;
+  camera.view = glm::lookAt(camera.eye, camera.target, camera.up);
+  camera.VP = camera.projection * camera.view;
+  bindBuffer (GL_UNIFORM_BUFFER, camera.UniformBuffer);
+  glBufferSubData (GL_UNIFORM_BUFFER, 0, sizeof(glm::mat4), &camera.VP[0][0]);
+  camera.dirty = false;
+}
+
+/* Framebuffer size as last reported by the window, in pixels. Read when
+   building a frame; the frame's submitFrame() sets the viewport. */
+int viewport_width, viewport_height;
+
 /* Executed when window is resized to 'width' and 'height' */
-/* Modify the bounds of the screen here in glm::ortho or Field of View in glm::Perspective */
+/* Runs on the thread handling window events, which need not own the GL
+   context: only the size is recorded here, see applyViewport() */
 void reshapeWindow (GLFWwindow* window, int width, int height)
 {
   int fbwidth=width, fbheight=height;
   /* With Retina display on Mac OS X, GLFW's FramebufferSize
   is different from WindowSize */
-  glfwGetFramebufferSize(window, &fbwidth, &fbheight);
+  // No window when rendering offscreen, the framebuffer has the given size
+  if (window)
+    glfwGetFramebufferSize(window, &fbwidth, &fbheight);
+  viewport_width = fbwidth;
+  viewport_height = fbheight;
+}
 
+/* Modify the bounds of the screen here in glm::ortho or Field of View in glm::Perspective */
+void applyViewport (int fbwidth, int fbheight)
+{
   GLfloat fov = 90.0f;
 
   // sets the viewport of openGL renderer
   glViewport (0, 0, (GLsizei) fbwidth, (GLsizei) fbheight);
+  camera.viewport_width = fbwidth;
+  camera.viewport_height = fbheight;
 
   // set the projection matrix as perspective
   /* glMatrixMode (GL_PROJECTION);
@@ -256,14 +462,12 @@ void reshapeWindow (GLFWwindow* window, int width, int height)
   // Matrices.projection = glm::perspective (fov, (GLfloat) fbwidth / (GLfloat) fbheight, 0.1f, 500.0f);
 
   // Ortho projection for 2D views
-  Matrices.projection = glm::ortho(-4.0f, 4.0f, -4.0f, 4.0f, 0.1f, 500.0f);
+  setCameraProjection(glm::ortho(-4.0f, 4.0f, -4.0f, 4.0f, 0.1f, 500.0f));
 }
 
-VAO *triangle, *rectangle1, *rectangle2, *line, *gun1, *gun2, *block1[6], *block2[6], *block3[6], *laser,*mirror1,*mirror2;
-
 // Creates the triangle object used in this sample code
 
-void createTriangle ()
+VAO* createTriangle ()
 {
   /* ONLY vertices between the bounds specified in glm::ortho will be visible on screen */
 
@@ -281,11 +485,11 @@ void createTriangle ()
   };
 
   // create3DObject creates and returns a handle to a VAO that can be used later
-  triangle = create3DObject(GL_TRIANGLES, 3, vertex_buffer_data, color_buffer_data, GL_FILL);
+  return create3DObject(GL_TRIANGLES, 3, vertex_buffer_data, color_buffer_data, GL_FILL);
 }
 
 // Creates the rectangle object used in this sample code
-void createRectangle1 ()
+VAO* createRectangle1 ()
 {
   // GL3 accepts only Triangles. Quads are not supported
   static const GLfloat vertex_buffer_data [] = {
@@ -309,9 +513,9 @@ void createRectangle1 ()
 
   };
   // create3DObject creates and returns a handle to a VAO that can be used later
-  rectangle1 = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
+  return create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
 }
-void createRectangle2 ()
+VAO* createRectangle2 ()
 {
   // GL3 accepts only Triangles. Quads are not supported
   static const GLfloat vertex_buffer_data [] = {
@@ -334,10 +538,10 @@ void createRectangle2 ()
     0.8,0,0, // color 1
   };
   // create3DObject creates and returns a handle to a VAO that can be used later
-  rectangle2 = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
+  return create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
 }
 
-void createLine ()
+VAO* createLine ()
 {
   // GL3 accepts only Triangles. Quads are not supported
   static const GLfloat vertex_buffer_data [] = {
@@ -361,10 +565,10 @@ void createLine ()
 
   };
   // create3DObject creates and returns a handle to a VAO that can be used later
-  line = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
+  return create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
 }
 
-void createGun1 ()
+VAO* createGun1 ()
 {
   // GL3 accepts only Triangles. Quads are not supported
   static const GLfloat vertex_buffer_data [] = {
@@ -388,10 +592,10 @@ void createGun1 ()
     0.2,0.2,1  // color 1
   };
   // create3DObject creates and returns a handle to a VAO that can be used later
-  gun1 = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
+  return create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
 }
 
-void createGun2 ()
+VAO* createGun2 ()
 {
   // GL3 accepts only Triangles. Quads are not supported
   static const GLfloat vertex_buffer_data [] = {
@@ -415,10 +619,93 @@ void createGun2 ()
     0.2,0.2,1  // color 1
   };
   // create3DObject creates and returns a handle to a VAO that can be used later
-  gun2 = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
+  return create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
+}
+
+/* A mesh from the shared buffer drawn many times with glDrawArraysInstanced;
+   the instance data is streamed each frame (see Stream) */
+struct InstancedVAO {
+  GLuint VertexArrayID;
+
+  struct VAO* Mesh;
+};
+typedef struct InstancedVAO InstancedVAO;
+
+/* Generate a VAO reading the mesh from the shared buffer plus per-instance
+   attributes (offset, rotation, color) */
+struct InstancedVAO* createInstanced3DObject (struct VAO* mesh)
+{
+  struct InstancedVAO* vao = new struct InstancedVAO;
+  vao->Mesh = mesh;
+
+  glGenVertexArrays(1, &(vao->VertexArrayID));
+
+  // Positions come straight from the shared mesh buffer, colors per instance
+  bindVertexArray (vao->VertexArrayID);
+  bindBuffer (GL_ARRAY_BUFFER, Meshes.VertexBuffer);
+  enableVertexAttrib(0);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, MESH_VERTEX_FLOATS*sizeof(GLfloat), (void*)0);
+
+  // Instance data moves around the stream buffer, so drawInstanced3DObject()
+  // points attributes 2 and 3 at it every frame
+  enableVertexAttrib(2);
+  glVertexAttribDivisor(2, 1);
+  enableVertexAttrib(3);
+  glVertexAttribDivisor(3, 1);
+
+  bindVertexArray (0);
+  return vao;
+}
+
+/* Instanced meshes, by the index render commands refer to them with */
+std::vector<InstancedVAO*> instanced_meshes;
+
+int addInstancedMesh (InstancedVAO* vao)
+{
+  instanced_meshes.push_back(vao);
+  return instanced_meshes.size() - 1;
 }
 
-void createBlock1 ()
+/* Render 'count' instances already written to the stream buffer at 'offset'
+   with one draw call */
+void drawStreamedInstances (struct InstancedVAO* vao, GLintptr offset, int count)
+{
+  setPolygonMode (vao->Mesh->FillMode);
+  bindVertexArray (vao->VertexArrayID);
+  bindBuffer (GL_ARRAY_BUFFER, Stream.Buffer);
+  glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(BlockInstance), (void*)(offset + offsetof(BlockInstance, x)));
+  glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(BlockInstance), (void*)(offset + offsetof(BlockInstance, r)));
+  glDrawArraysInstanced(vao->Mesh->PrimitiveMode, vao->Mesh->FirstVertex, vao->Mesh->NumVertices, count);
+}
+
+/* Upload this frame's instances and render all of them with one draw call */
+void drawInstanced3DObject (struct InstancedVAO* vao, const BlockInstance* instances, int count)
+{
+  if (count <= 0)
+    return;
+
+  GLintptr offset;
+  void* data = streamAlloc (Stream, count*sizeof(BlockInstance), sizeof(GLfloat), &offset);
+  memcpy (data, instances, count*sizeof(BlockInstance));
+  streamCommit (Stream);
+  drawStreamedInstances (vao, offset, count);
+}
+
+/* What covers what: commands are drawn layer by layer, see renderKey() */
+enum RenderLayer {
+  LAYER_BLOCKS,
+  LAYER_PARTICLES,
+  LAYER_BASKETS,
+  LAYER_FLOOR,
+  LAYER_GUN,
+  LAYER_LASER,
+  LAYER_MIRRORS
+};
+
+int block_mesh;
+
+/* All falling blocks share one quad; color comes from the instance data */
+void createBlocks ()
 {
   // GL3 accepts only Triangles. Quads are not supported
   static const GLfloat vertex_buffer_data [] = {
@@ -431,91 +718,95 @@ void createBlock1 ()
     -0.05,-0.15,0  // vertex 1
   };
 
-  static const GLfloat color_buffer_data [] = {
-    1,0,0, // color 1
-    1,0,0, // color 2
-    1,0,0, // color 3
-
-    1,0,0, // color 3
-    1,0,0, // color 4
-    1,0,0, // color 1
-
-  };
-  // create3DObject creates and returns a handle to a VAO that can be used later
-  int i;
-  for (i=0;i<6;i++)
-  block1[i] = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
+  // The mesh color is unused, the instanced shader takes it per instance
+  VAO* block = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, 0, 0, 0, GL_FILL);
+  block_mesh = addInstancedMesh(createInstanced3DObject(block));
 }
 
-void createBlock2 ()
-{
-  // GL3 accepts only Triangles. Quads are not supported
-  static const GLfloat vertex_buffer_data [] = {
-   -0.05,-0.15,0, // vertex 1
-   0.05,-0.15,0, // vertex 2
-   0.05, 0.15,0, // vertex 3
-
-   0.05, 0.15,0, // vertex 3
-   -0.05, 0.15,0, // vertex 4
-   -0.05,-0.15,0  // vertex 1
- };
+static const GLfloat block_colors[BLOCK_KINDS][3] = { {1,0,0}, {0,1,0}, {0,0,0} };
 
- static const GLfloat color_buffer_data [] = {
-  0,1,0, // color 1
-  0,1,0, // color 2
-  0,1,0, // color 3
+/* Debris from shot and caught blocks, drawn like the blocks with a smaller
+   quad. Particles fade into the background color as they age. */
+const int SHOT_PARTICLES = 48;
+const int CAUGHT_PARTICLES = 24;
+const GLfloat BACKGROUND_GRAY = 0.7;
 
-  0,1,0, // color 3
-  0,1,0, // color 4
-  0,1,0, // color 1
+ParticlePool particles;
+int particle_mesh;
 
-};
-// create3DObject creates and returns a handle to a VAO that can be used later
-int i;
-for (i=0;i<6;i++)
-block2[i] = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
+/* Game hook: a block was just shot or caught */
+void blockRemoved (int id, int cause)
+{
+  const BlockPool& pool = block_pool;
+  emitParticles(particles, pool.x[id], pool.y[id], pool.kind[id], cause == REMOVED_SHOT ? SHOT_PARTICLES : CAUGHT_PARTICLES);
 }
 
-void createBlock3 ()
+void createParticles ()
 {
   // GL3 accepts only Triangles. Quads are not supported
   static const GLfloat vertex_buffer_data [] = {
-   -0.05,-0.15,0, // vertex 1
-   0.05,-0.15,0, // vertex 2
-   0.05, 0.15,0, // vertex 3
+    -0.02,-0.02,0, // vertex 1
+    0.02,-0.02,0, // vertex 2
+    0.02, 0.02,0, // vertex 3
 
-   0.05, 0.15,0, // vertex 3
-   -0.05, 0.15,0, // vertex 4
-   -0.05,-0.15,0  // vertex 1
- };
+    0.02, 0.02,0, // vertex 3
+    -0.02, 0.02,0, // vertex 4
+    -0.02,-0.02,0  // vertex 1
+  };
 
- static const GLfloat color_buffer_data [] = {
-  0,0,0, // color 1
-  0,0,0, // color 2
-  0,0,0, // color 3
+  VAO* quad = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, 0, 0, 0, GL_FILL);
+  particle_mesh = addInstancedMesh(createInstanced3DObject(quad));
+  initParticles(particles, MAX_PARTICLES);
+  block_removed = blockRemoved;
+}
 
-  0,0,0, // color 3
-  0,0,0, // color 4
-  0,0,0, // color 1
+/* Particle instances written per job when building the instance data */
+const int INSTANCES_PER_JOB = 8192;
 
-};
-// create3DObject creates and returns a handle to a VAO that can be used later
-int i;
-for(i=0;i<6;i++)
-block3[i] = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
+static void buildParticleInstances (void* data, int begin, int end)
+{
+  BlockInstance* out = (BlockInstance*)data;
+  int i;
+  for (i=begin;i<end;i++)
+  {
+    const GLfloat* color = block_colors[particles.kind[i]];
+    GLfloat fade = particles.life[i] * (1 / PARTICLE_LIFE);
+    out[i].x = particles.x[i];
+    out[i].y = particles.y[i];
+    out[i].rotation = 0;
+    out[i].r = BACKGROUND_GRAY + (color[0] - BACKGROUND_GRAY)*fade;
+    out[i].g = BACKGROUND_GRAY + (color[1] - BACKGROUND_GRAY)*fade;
+    out[i].b = BACKGROUND_GRAY + (color[2] - BACKGROUND_GRAY)*fade;
+  }
+}
+
+/* Every live particle as an instance of the particle quad, drawn with one
+   instanced call */
+void buildParticles (RenderFrame& frame)
+{
+  int n = particles.count;
+  if (n == 0)
+    return;
+  InstancedVAO* quads = instanced_meshes[particle_mesh];
+  RenderCommand command = { renderKey(LAYER_PARTICLES, PROGRAM_INSTANCED, particle_mesh, fillModeIndex(quads->Mesh->FillMode)),
+                            RENDER_INSTANCES, particle_mesh, (int)frame.instances.size(), n };
+  frame.instances.resize(command.first + n);
+  parallelFor (n, INSTANCES_PER_JOB, buildParticleInstances, &frame.instances[command.first]);
+  frame.commands.push_back(command);
 }
 
-void createLaser ()
+/* One unit of beam along +x; each beam segment scales it to its length */
+VAO* createLaser ()
 {
   // GL3 accepts only Triangles. Quads are not supported
   static const GLfloat vertex_buffer_data [] = {
-    0.8,-0.03,0, // vertex 1
-    1.1,-0.03,0, // vertex 2
-    1.1, 0.03,0, // vertex 3
+    0,-0.03,0, // vertex 1
+    1,-0.03,0, // vertex 2
+    1, 0.03,0, // vertex 3
 
-    1.1, 0.03,0, // vertex 3
-    0.8, 0.03,0, // vertex 4
-    0.8,-0.03,0  // vertex 1
+    1, 0.03,0, // vertex 3
+    0, 0.03,0, // vertex 4
+    0,-0.03,0  // vertex 1
   };
 
   static const GLfloat color_buffer_data [] = {
@@ -529,9 +820,9 @@ void createLaser ()
 
   };
   // create3DObject creates and returns a handle to a VAO that can be used later
-  laser = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
+  return create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
 }
-void createMirror1()
+VAO* createMirror1 ()
 {
   static const GLfloat vertex_buffer_data [] = {
     -0.45,-0.1,0, // vertex 1
@@ -554,9 +845,9 @@ void createMirror1()
 
   };
   // create3DObject creates and returns a handle to a VAO that can be used later
-  mirror1 = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
+  return create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
 }
-void createMirror2()
+VAO* createMirror2 ()
 {
   static const GLfloat vertex_buffer_data [] = {
     -0.45,-0.1,0, // vertex 1
@@ -579,44 +870,184 @@ void createMirror2()
 
   };
   // create3DObject creates and returns a handle to a VAO that can be used later
-  mirror2 = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
+  return create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
 }
 
-void GameOver()
+/* Every object but the blocks and the particles is an entity of the game's
+   world (game.h); the renderer gives each a Renderable naming its mesh in
+   scene_meshes. buildFrame() draws whatever has a Transform and a
+   Renderable, lowest layer first, so a new kind of object needs a mesh and
+   entities but no code in buildFrame(). */
+std::vector<VAO*> scene_meshes;
+/* Drawn only: they follow the game state, see updateSceneEntities() */
+Entity gun_base;
+Entity laser_segments[LASER_MAX_BOUNCES+1];
+
+/* The frame buildFrame() is filling, for renderSystem */
+RenderFrame* building_frame;
+
+int addSceneMesh (VAO* mesh)
+{
+  scene_meshes.push_back(mesh);
+  return scene_meshes.size() - 1;
+}
+
+/* Draw 'entity' with scene mesh 'mesh' from now on */
+void makeRenderable (Entity entity, int mesh, int layer)
 {
-  exit(0);
+  addComponents(world, entity, HAS_RENDERABLE);
+  Renderable* r = (Renderable*)getComponent(world, entity, COMPONENT_RENDERABLE);
+  r->mesh = mesh;
+  r->layer = layer;
+}
+
+/* A command and a model matrix for every visible entity */
+void renderSystem (Archetype& archetype, float alpha)
+{
+  RenderFrame& frame = *building_frame;
+  const Transform* t = (const Transform*)column(archetype, COMPONENT_TRANSFORM);
+  const Renderable* r = (const Renderable*)column(archetype, COMPONENT_RENDERABLE);
+  int i;
+  for (i=0;i<archetype.count;i++) {
+    if (!r[i].visible)
+      continue;
+    RenderCommand object = { renderKey(r[i].layer, PROGRAM_OBJECTS, r[i].mesh, fillModeIndex(scene_meshes[r[i].mesh]->FillMode)),
+                             RENDER_OBJECT, r[i].mesh, (int)frame.models.size(), 1 };
+    frame.models.push_back (glm::translate (glm::vec3(t[i].x, t[i].y, 0))
+      * glm::rotate ((float)(t[i].rotation*M_PI/180.0f), glm::vec3(0,0,1))
+      * glm::scale (glm::vec3(t[i].scale_x, t[i].scale_y, 1)));
+    frame.commands.push_back(object);
+  }
+}
+
+/* Create the meshes and entities of the scene */
+void createScene ()
+{
+  initGameWorld ();
+  makeRenderable (green_basket, addSceneMesh(createRectangle1()), LAYER_BASKETS);
+  makeRenderable (red_basket, addSceneMesh(createRectangle2()), LAYER_BASKETS);
+
+  Entity floor_line = createEntity (world, HAS_TRANSFORM);
+  transformOf(floor_line).y = -3.2;
+  makeRenderable (floor_line, addSceneMesh(createLine()), LAYER_FLOOR);
+
+  gun_base = createEntity (world, HAS_TRANSFORM);
+  transformOf(gun_base).x = -3.65;
+  makeRenderable (gun_base, addSceneMesh(createGun1()), LAYER_GUN);
+  makeRenderable (gun, addSceneMesh(createGun2()), LAYER_GUN);
+
+  int laser = addSceneMesh(createLaser());
+  int k;
+  for (k=0;k<=LASER_MAX_BOUNCES;k++) {
+    laser_segments[k] = createEntity (world, HAS_TRANSFORM);
+    makeRenderable (laser_segments[k], laser, LAYER_LASER);
+  }
+
+  makeRenderable (mirrors[0], addSceneMesh(createMirror1()), LAYER_MIRRORS);
+  makeRenderable (mirrors[1], addSceneMesh(createMirror2()), LAYER_MIRRORS);
+
+  addSystem (world, "render", PHASE_RENDER, HAS_TRANSFORM | HAS_RENDERABLE, renderSystem);
+}
+
+/* Bring the drawn-only entities in line with the game state */
+void updateSceneEntities ()
+{
+  transformOf(gun_base).y = transformOf(gun).y;
+
+  // The beam is drawn as one stretched quad per segment while it lasts
+  int k;
+  for (k=0;k<=LASER_MAX_BOUNCES;k++) {
+    Renderable* r = (Renderable*)getComponent(world, laser_segments[k], COMPONENT_RENDERABLE);
+    r->visible = laser_beam.ticks_left>0 && k+1<laser_beam.vertices;
+    if (!r->visible)
+      continue;
+    float dx = laser_beam.x[k+1]-laser_beam.x[k], dy = laser_beam.y[k+1]-laser_beam.y[k];
+    Transform& t = transformOf(laser_segments[k]);
+    t.x = laser_beam.x[k];
+    t.y = laser_beam.y[k];
+    t.rotation = atan2(dy, dx)*180/M_PI;
+    t.scale_x = sqrt(dx*dx + dy*dy);
+  }
 }
 
 float camera_rotation_angle = 90;
-float rectangle_rotation = 0;
-float mirror1_rotation = 0;
-float mirror2_rotation = 90;
-float gun2_rotation = 0;
-float laser_rotation = gun2_rotation;
 float triangle_rotation = 0;
-float red_move[6]; //= 4.2;
-float green_move[6]; //= 4.2;
-float black_move[6];// = 4.2;
-float increase = 0.003;
-float decrease = -0.003;
-float speed = 0.01;
-float red_pos[6], green_pos[6], black_pos[6];
-float laser_xpos=-3.5;
-float laser_ypos=gun_ypos;
-int spc=0;
-float r=0.3;
-float red_ypos,green_ypos,black_ypos;
-int points=0;
-int flag=0;
-int reflected=0;
-/* Render the scene with openGL */
-/* Edit this function according to your assignment */
+
+/* Longest frame the accumulator will try to catch up on (avoids a death spiral) */
+const double MAX_FRAME_TIME = 0.25;
+
 void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods);
 void mouseButton (GLFWwindow* window, int button, int action, int mods);
 
-void draw ()
+/* Replay being played back instead of live input, if any */
+Replay playback;
+bool playing_back = false;
+size_t playback_next = 0;
+
+/* Apply a live player action, logging it first when recording */
+void playerAction (int action)
+{
+  if (playing_back)
+    return;
+  recordAction(game_tick, action);
+  gameAction(action);
+}
+
+/* Feed the recorded actions due before the next tick */
+void playbackActions ()
+{
+  while (playback_next < playback.events.size() && playback.events[playback_next].tick <= game_tick)
+    gameAction(playback.events[playback_next++].action);
+}
+
+/* Use the previous tick's value unless the object teleported (hit, respawn) */
+float interpolate (float previous, float current, float alpha)
+{
+  if (fabs(current - previous) > 1)
+    return current;
+  return previous + (current - previous)*alpha;
+}
+
+/* Collect what the frame shows from the game state, with no GL calls */
+/* alpha is how far we are between the last two simulation ticks, in [0,1) */
+void buildFrame (RenderFrame& frame, float alpha)
+{
+  frame.viewport_width = viewport_width;
+  frame.viewport_height = viewport_height;
+
+  const BlockPool& pool = block_pool;
+  // Only blocks the simulation flagged as on screen, 64 at a time
+  InstancedVAO* quads = instanced_meshes[block_mesh];
+  RenderCommand blocks = { renderKey(LAYER_BLOCKS, PROGRAM_INSTANCED, block_mesh, fillModeIndex(quads->Mesh->FillMode)),
+                           RENDER_INSTANCES, block_mesh, (int)frame.instances.size(), 0 };
+  size_t w;
+  for (w=0;w<pool.visible.size();w++)
+  for (uint64_t bits=pool.visible[w];bits;bits&=bits-1)
+  {
+    int j = w*64 + __builtin_ctzll(bits);
+    const GLfloat* color = block_colors[pool.kind[j]];
+    BlockInstance block = { pool.x[j], interpolate(pool.prev_y[j], pool.y[j], alpha), rectangle_rotation, color[0], color[1], color[2] };
+    frame.instances.push_back(block);
+  }
+  // All blocks share one mesh, so render them with a single instanced draw
+  blocks.count = frame.instances.size() - blocks.first;
+  if (blocks.count > 0)
+    frame.commands.push_back(blocks);
+  buildParticles(frame);
+
+  // Everything else: transforms kept by the game or updateSceneEntities(),
+  // collected by renderSystem
+  updateSceneEntities();
+  building_frame = &frame;
+  runSystems(world, PHASE_RENDER, alpha);
+
+  // Into layer order, with the draws sharing a program and mesh together
+  sortRenderCommands(frame);
+}
+
+/* Render a frame's commands with openGL, on the thread owning the context */
+void submitFrame (const RenderFrame& frame)
 {
-  srand(time(NULL));
   /* FTGLPixmapFont font("/home/user/Arial.ttf");
 
   // If something went wrong, bail out.
@@ -627,309 +1058,41 @@ void draw ()
   font.FaceSize(72);
   font.Render("Hello World!");
   */
+  if (frame.viewport_width != camera.viewport_width || frame.viewport_height != camera.viewport_height)
+    applyViewport(frame.viewport_width, frame.viewport_height);
+
   // clear the color and depth in the frame buffer
   glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-  // use the loaded shader program
-  // Don't change unless you know what you are doing
-  glUseProgram (programID);
-
-  // Eye - Location of camera. Don't change unless you are sure!!
-  glm::vec3 eye ( 5*cos(camera_rotation_angle*M_PI/180.0f), 0, 5*sin(camera_rotation_angle*M_PI/180.0f) );
-  // Target - Where is the camera looking at.  Don't change unless you are sure!!
-  glm::vec3 target (0, 0, 0);
-  // Up - Up vector defines tilt of camera.  Don't change unless you are sure!!
-  glm::vec3 up (0, 1, 0);
-
-  // Compute Camera matrix (view)
-  // Matrices.view = glm::lookAt( eye, target, up ); // Rotating Camera for 3D
-  //  Don't change unless you are sure!!
-  Matrices.view = glm::lookAt(glm::vec3(0,0,3), glm::vec3(0,0,0), glm::vec3(0,1,0)); // Fixed camera for 2D (ortho) in XY plane
-
-  // Compute ViewProject matrix as view/camera might not be changed for this frame (basic scenario)
-  //  Don't change unless you are sure!!
-  glm::mat4 VP = Matrices.projection * Matrices.view;
-
-  // Send our transformation to the currently bound shader, in the "MVP" uniform
-  // For each model you render, since the MVP will be different (at least the M part)
-  //  Don't change unless you are sure!!
-  glm::mat4 MVP;  // MVP = Projection * View * Model
-
-  // Load identity to model matrix
-  
-  //Matrices.model = glm::mat4(1.0f);
-
-  /* Render your scene */
-
-  // Pop matrix to undo transformations till last push matrix instead of recomputing model matrix
-  // glPopMatrix ();
-  float dist=0.8;
-  int j,k,l,countr=0,countg=0,countb=0,x;
-  for (j=0;j<6;j++)
-  {
-    int i;
-    red_ypos = red_move[j]+red_pos[j];
-    Matrices.model = glm::mat4(1.0f);
-
-    glm::mat4 translateBlock1 = glm::translate (glm::vec3(-0.75+(dist*j),red_ypos , 0));        // glTranslatef
-    glm::mat4 rotateBlock1 = glm::rotate((float)(rectangle_rotation*M_PI/180.0f), glm::vec3(0,0,1)); // rotate about vector (-1,1,1)
-    Matrices.model *= (translateBlock1 * rotateBlock1);
-    MVP = VP * Matrices.model;
-    glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-    // draw3DObject draws the VAO given to it using current MVP matrix 
-    if(laser_ypos<(red_ypos+0.145) && laser_ypos>(red_ypos-0.145) && (laser_xpos+1.1*cos((laser_rotation*M_PI/180.0f)))>-0.75+(dist*j) && -0.75+(dist*j)>(laser_xpos+0.8*cos((laser_rotation*M_PI/180.0f))))
-    {
-      flag=1;
-      laser_xpos=5;
-      laser_ypos=-5;
-      red_move[j]=-15;
-    }
-    if(red_ypos<-3.32 && red_ypos>-3.34 && (-0.75+(dist*j))>rect2_xpos-0.45 && (-0.75+(dist*j))<rect2_xpos+0.45 )
-    {
-      flag=2;
-      red_move[j]=-15;
-    }
-    if (red_ypos<-4.2)
-    {
-      countr+=1;
+  // VP only changes on reshape or camera moves; the shaders read it from the
+  // Camera uniform block
+  updateCamera();
+
+  // Commands come sorted, so the program and mesh change only between runs
+  // of draws; gl_state.h drops the calls that set them to what they are.
+  // Objects are queued and drawn together, with one transform upload, at
+  // the next flushObjects().
+  size_t i;
+  for (i=0;i<frame.commands.size();i++) {
+    const RenderCommand& command = frame.commands[i];
+    if (command.type == RENDER_INSTANCES) {
+      flushObjects();
+      useProgram (instancedProgramID);
+      drawInstanced3DObject(instanced_meshes[command.mesh], &frame.instances[command.first], command.count);
     }
-    if(countr==6)
-    { 
-      for(i=0;i<6;i++)
-      red_move[i] = 4.2;
-      for (x=0;x<6;x++)
-      red_pos[x] = rand() % 10; 
-      countr=0;
-    }
-
-    draw3DObject(block1[j]);
-    
+    else
+      queueObject(scene_meshes[command.mesh], frame.models[command.first]);
   }
-  for(k=0;k<6;k++)
-  {
-    int i;
-    green_ypos=green_move[k]+green_pos[k];
-    Matrices.model = glm::mat4(1.0f);
-
-    glm::mat4 translateBlock2 = glm::translate (glm::vec3(-0.5+(dist*k),green_ypos, 0));        // glTranslatef
-    glm::mat4 rotateBlock2 = glm::rotate((float)(rectangle_rotation*M_PI/180.0f), glm::vec3(0,0,1)); // rotate about vector (-1,1,1)
-    Matrices.model *= (translateBlock2 * rotateBlock2);
-    MVP = VP * Matrices.model;
-    glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-    //(laser_xpos+0.8)==(-1.5+(dist*k)) && 
-    // draw3DObject draws the VAO given to it using current MVP matrix
-    if(laser_ypos<(green_ypos+0.145) && laser_ypos>(green_ypos-0.145) && (laser_xpos+1.1*cos((laser_rotation*M_PI/180.0f)))>-0.5+(dist*k) && -0.5+(dist*k)>(laser_xpos+0.8*cos((laser_rotation*M_PI/180.0f))))
-    {
-      flag=1;
-      laser_xpos=5;
-      laser_ypos=-5;
-      green_move[k]=-15;
-    }
-    if(green_ypos<-3.32 && green_ypos>-3.34 && (-0.5+(dist*k))>rect1_xpos-0.45 && (-0.5+(dist*k))<rect1_xpos+0.45 )
-    {
-      flag=2;
-      green_move[k]=-15;
-    }
-    if(green_ypos<-4.2)
-    {
-      countg+=1;
-    }
-    if(countg==6)
-    { 
-      for(i=0;i<6;i++)
-      green_move[i] = 4.2;
-      for (x=0;x<6;x++)
-      green_pos[x] = rand() % 10; 
-      countg=0;
-    }
+  flushObjects();
+}
 
-    draw3DObject(block2[k]);
-  }
-  for(l=0;l<6;l++)
-  {
-    int i;
-    black_ypos = black_move[l]+black_pos[l];
-    Matrices.model = glm::mat4(1.0f);
-
-    glm::mat4 translateBlock3 = glm::translate (glm::vec3(-1+(dist*l),black_ypos , 0));        // glTranslatef
-    glm::mat4 rotateBlock3 = glm::rotate((float)(rectangle_rotation*M_PI/180.0f), glm::vec3(0,0,1)); // rotate about vector (-1,1,1)
-    Matrices.model *= (translateBlock3 * rotateBlock3);
-    MVP = VP * Matrices.model;
-    glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-    // draw3DObject draws the VAO given to it using current MVP matrix
-    if(laser_ypos<(black_ypos+0.145) && laser_ypos>(black_ypos-0.145) && (laser_xpos+1.1*cos((laser_rotation*M_PI/180.0f)))>-1+(dist*l) && -1+(dist*l)>(laser_xpos+0.8*cos((laser_rotation*M_PI/180.0f))))
-    {
-      flag=2;
-      laser_xpos=5;
-      laser_ypos=-5;
-      black_move[l]=-15;
-    }
-    if(black_ypos<-3.32 && black_ypos>-3.34 && (-1+(dist*l))>(rect2_xpos-0.45) && (-1+(dist*l))< (rect2_xpos+0.45) )
-    {
-      flag=1;
-      black_move[l]=-15;
-    }
-    else if ( black_ypos<-3.32 && black_ypos>-3.34 && (-1+(dist*l))>(rect1_xpos-0.45) && (-1+(dist*l))< (rect1_xpos+0.45) )
-    {
-      flag=1;
-      black_move[l]=-15;
-    }
-    if (black_ypos<-4.2)
-    {
-      countb+=1;
-    }
-    if(countb==6)
-    { 
-      for(i=0;i<6;i++)
-      black_move[i] = 4.2;
-      for (x=0;x<6;x++)
-      black_pos[x] = rand() % 10; 
-      countb=0;
-    }
-    draw3DObject(block3[l]);
-  }
-  Matrices.model = glm::mat4(1.0f);
-
-  glm::mat4 translateRectangle1 = glm::translate (glm::vec3(rect1_xpos, -3.67, 0));        // glTranslatef
-  glm::mat4 rotateRectangle1 = glm::rotate((float)(rectangle_rotation*M_PI/180.0f), glm::vec3(0,0,1)); // rotate about vector (-1,1,1)
-  Matrices.model *= (translateRectangle1 * rotateRectangle1);
-  MVP = VP * Matrices.model;
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-  // draw3DObject draws the VAO given to it using current MVP matrix
-  draw3DObject(rectangle1);
-
-  Matrices.model = glm::mat4(1.0f);
-
-  glm::mat4 translateRectangle2 = glm::translate (glm::vec3(rect2_xpos, -3.67, 0));        // glTranslatef
-  glm::mat4 rotateRectangle2 = glm::rotate((float)(rectangle_rotation*M_PI/180.0f), glm::vec3(0,0,1)); // rotate about vector (-1,1,1)
-  Matrices.model *= (translateRectangle2 * rotateRectangle2);
-  MVP = VP * Matrices.model;
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-  // draw3DObject draws the VAO given to it using current MVP matrix
-  draw3DObject(rectangle2);
-  
-  Matrices.model = glm::mat4(1.0f);
-
-  glm::mat4 translateLine = glm::translate (glm::vec3(0, -3.2, 0));        // glTranslatef
-  glm::mat4 rotateLine = glm::rotate((float)(rectangle_rotation*M_PI/180.0f), glm::vec3(0,0,1)); // rotate about vector (-1,1,1)
-  Matrices.model *= (translateLine * rotateLine);
-  MVP = VP * Matrices.model;
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-  // draw3DObject draws the VAO given to it using current MVP matrix
-  draw3DObject(line);
-  
-  Matrices.model = glm::mat4(1.0f);
-
-  glm::mat4 translateGun1 = glm::translate (glm::vec3(-3.65, gun_ypos, 0));        // glTranslatef
-  glm::mat4 rotateGun1 = glm::rotate((float)(rectangle_rotation*M_PI/180.0f), glm::vec3(0,0,1)); // rotate about vector (-1,1,1)
-  Matrices.model *= (translateGun1 * rotateGun1);
-  MVP = VP * Matrices.model;
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-  // draw3DObject draws the VAO given to it using current MVP matrix
-  draw3DObject(gun1);
-  
-  Matrices.model = glm::mat4(1.0f);
-
-  glm::mat4 translateGun2 = glm::translate (glm::vec3(-3.5, gun_ypos, 0));        // glTranslatef
-  glm::mat4 rotateGun2 = glm::rotate((float)(gun2_rotation*M_PI/180.0f), glm::vec3(0,0,1)); // rotate about vector (-1,1,1)
-  Matrices.model *= (translateGun2 * rotateGun2);
-  MVP = VP * Matrices.model;
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-  // draw3DObject draws the VAO given to it using current MVP matrix
-  draw3DObject(gun2);
-
-  if (reflected==0) 
-  laser_rotation=gun2_rotation;
-
-  Matrices.model = glm::mat4(1.0f);
-
-  glm::mat4 translateLaser = glm::translate (glm::vec3(laser_xpos, laser_ypos, 0));        // glTranslatef
-  glm::mat4 rotateLaser = glm::rotate((float)(laser_rotation*M_PI/180.0f), glm::vec3(0,0,1)); // rotate about vector (-1,1,1)
-  Matrices.model *= (translateLaser * rotateLaser);
-  MVP = VP * Matrices.model;
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-  // draw3DObject draws the VAO given to it using current MVP matrix
-  draw3DObject(laser);
-
-  Matrices.model = glm::mat4(1.0f);
-
-  glm::mat4 translateMirror1 = glm::translate (glm::vec3(0, 3, 0));        // glTranslatef
-  glm::mat4 rotateMirror1 = glm::rotate((float)(mirror1_rotation*M_PI/180.0f), glm::vec3(0,0,1)); // rotate about vector (-1,1,1)
-  Matrices.model *= (translateMirror1 * rotateMirror1);
-  MVP = VP * Matrices.model;
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-  // draw3DObject draws the VAO given to it using current MVP matrix
-  draw3DObject(mirror1);
-
-  Matrices.model = glm::mat4(1.0f);
-
-  glm::mat4 translateMirror2 = glm::translate (glm::vec3(3.2, 0.5, 0));        // glTranslatef
-  glm::mat4 rotateMirror2 = glm::rotate((float)(mirror2_rotation*M_PI/180.0f), glm::vec3(0,0,1)); // rotate about vector (-1,1,1)
-  Matrices.model *= (translateMirror2 * rotateMirror2);
-  MVP = VP * Matrices.model;
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-  // draw3DObject draws the VAO given to it using current MVP matrix
-  draw3DObject(mirror2);
-
-  if (laser_ypos+1.1*sin((laser_rotation*M_PI/180.0f))>3 && laser_ypos+1.1*sin((laser_rotation*M_PI/180.0f))<3.2 && (laser_xpos+1.1*cos((laser_rotation*M_PI/180.0f)))<0.45 && (laser_xpos+1.1*cos((laser_rotation*M_PI/180.0f)))>-0.5)
-  {
-    reflected=1;
-    laser_rotation=-laser_rotation;
-    laser_ypos=3.1;
-    laser_xpos=laser_xpos+1.1*cos((laser_rotation*M_PI/180.0f));
-  }
-  if (laser_ypos+1.1*sin((laser_rotation*M_PI/180.0f))>0.05 && laser_ypos+1.1*sin((laser_rotation*M_PI/180.0f))<0.95 && (laser_xpos+1.1*cos((laser_rotation*M_PI/180.0f)))<3.3 && (laser_xpos+1.1*cos((laser_rotation*M_PI/180.0f)))>3)
-  {
-    reflected=1;
-    if(laser_rotation<0)
-    laser_rotation-=(180+2*laser_rotation);
-    else if(laser_rotation>=0)
-    laser_rotation=180-laser_rotation;
-    
-    laser_xpos=3.2;
-    laser_ypos=laser_ypos+1.1*sin((laser_rotation*M_PI/180.0f));
-  }
-  if(spc==1 || reflected==1)
-  {   
-    laser_xpos+=r*cos(laser_rotation*M_PI/180.0f);
-    laser_ypos+=r*sin(laser_rotation*M_PI/180.0f);
-  }
-  int y;
-  for(y=0;y<6;y++)
-  {
-    red_move[y] =  red_move[y] - speed;
-    green_move[y] = green_move[y] - speed;
-    black_move[y] = black_move[y] - speed;
-  }
-  if(laser_xpos>12 || laser_ypos>12 || laser_xpos<-12 || laser_ypos<-12)
-  {
-        laser_xpos=-3.5;
-        laser_ypos=gun_ypos;
-        spc=0;
-        reflected=0;
-  }
-  if(flag==1)
-  {
-    points-=5;
-    flag=0;
-  }
-  if (flag==2)
-  {
-    points+=10;
-    flag=0;
-  }
-  printf("points: %d\n",points);
-  if (points<-40)
-  GameOver();
+/* Build a frame and submit it right away, on the thread owning the context */
+void draw (float alpha)
+{
+  static RenderFrame frame;
+  clearRenderFrame(frame);
+  buildFrame(frame, alpha);
+  submitFrame(frame);
 }
 
 void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
@@ -938,70 +1101,48 @@ void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
  int ctrl_status_right = glfwGetKey(window, GLFW_KEY_RIGHT_CONTROL);
  int alt_status_left = glfwGetKey(window, GLFW_KEY_LEFT_ALT);
  int alt_status_right = glfwGetKey(window, GLFW_KEY_RIGHT_ALT);
+ bool ctrl = (ctrl_status_right==GLFW_PRESS || ctrl_status_left==GLFW_PRESS);
+ bool alt = (alt_status_right==GLFW_PRESS || alt_status_left==GLFW_PRESS);
  // Function is called first on GLFW_PRESS.
  if (action == GLFW_RELEASE) {
   switch (key) {
     case GLFW_KEY_LEFT:
-    if (rect2_xpos>=-2.2 && (ctrl_status_right==GLFW_PRESS || ctrl_status_left==GLFW_PRESS) )
-    {
-      rect2_xpos -= 0.2;
-      ctrl_status_right==GLFW_RELEASE;
-      ctrl_status_left==GLFW_RELEASE;
-    }
-    else if (rect1_xpos>=-2.2 && (alt_status_right==GLFW_PRESS || alt_status_left==GLFW_PRESS) )
-    {
-      rect1_xpos -= 0.2;
-      alt_status_right==GLFW_RELEASE;
-      alt_status_left==GLFW_RELEASE; 
-    }          
+    if (ctrl)
+    playerAction(ACTION_RED_BASKET_LEFT);
+    else if (alt)
+    playerAction(ACTION_GREEN_BASKET_LEFT);
     break;
     case GLFW_KEY_RIGHT:
-    if (rect2_xpos<=3.4 && (ctrl_status_right==GLFW_PRESS || ctrl_status_left==GLFW_PRESS) )
-    {
-      rect2_xpos += 0.2;
-      ctrl_status_right==GLFW_RELEASE;
-      ctrl_status_left==GLFW_RELEASE;
-    }
-    else if (rect1_xpos<=3.4 && (alt_status_right==GLFW_PRESS || alt_status_left==GLFW_PRESS) )
-    { 
-      rect1_xpos += 0.2;
-      alt_status_right==GLFW_RELEASE;
-      alt_status_left==GLFW_RELEASE; 
-    }
+    if (ctrl)
+    playerAction(ACTION_RED_BASKET_RIGHT);
+    else if (alt)
+    playerAction(ACTION_GREEN_BASKET_RIGHT);
     break;
     case GLFW_KEY_S:
-    if (gun_ypos<=2.5)
-    {
-      gun_ypos += 0.2;
-      laser_ypos=gun_ypos;
-    }
+    playerAction(ACTION_GUN_UP);
     break;
     case GLFW_KEY_F:
-    if (gun_ypos>=-1.4)
-    {
-      gun_ypos -= 0.2;
-      laser_ypos=gun_ypos;
-    }
+    playerAction(ACTION_GUN_DOWN);
     break;
     case GLFW_KEY_M:
-    if (speed>0.004)
-    speed = speed + decrease;
+    playerAction(ACTION_SLOWER);
     break;
     case GLFW_KEY_N:
-    if(speed<3)
-    speed = speed + increase;
+    playerAction(ACTION_FASTER);
     break;
     case GLFW_KEY_SPACE:
-    spc=1;
+    playerAction(ACTION_FIRE);
+    break;
+    case GLFW_KEY_A:
+    playerAction(ACTION_GUN_TILT_UP);
+    break;
+    case GLFW_KEY_D:
+    playerAction(ACTION_GUN_TILT_DOWN);
     break;
     default:
     break;
   }
 }
-if (action == GLFW_RELEASE && key == GLFW_KEY_A && gun2_rotation <= 55)
-gun2_rotation = gun2_rotation + increments*gun2_rot_dir_pos;  
-if (action == GLFW_RELEASE && key == GLFW_KEY_D && gun2_rotation >= -55)
-gun2_rotation = gun2_rotation + increments*gun2_rot_dir_neg; 
 else if (action == GLFW_PRESS) 
 {
   switch (key) 
@@ -1020,11 +1161,11 @@ void mouseButton (GLFWwindow* window, int button, int action, int mods)
   switch (button) {
     case GLFW_MOUSE_BUTTON_LEFT:
     if (action == GLFW_RELEASE)
-    spc=1;
+    playerAction(ACTION_FIRE);
     break;
     case GLFW_MOUSE_BUTTON_RIGHT:
     if (action == GLFW_RELEASE) {
-      gun2_rot_dir_pos *= -1;
+      playerAction(ACTION_FLIP_TILT);
     }
     break;
     default:
@@ -1079,84 +1220,545 @@ GLFWwindow* initGLFW (int width, int height)
   return window;
 }
 
+/* Every program with the files it is built from, so they can be reloaded */
+struct ShaderProgram {
+  GLuint* ID;
+  const char* VertexPath;
+  const char* FragmentPath;
+};
+typedef struct ShaderProgram ShaderProgram;
+
+const ShaderProgram shader_programs[] = {
+  { &programID, "Sample_GL.vert", "Sample_GL.frag" },
+  // The falling blocks are instanced and get their model transform per instance
+  { &instancedProgramID, "Sample_GL_instanced.vert", "Sample_GL.frag" }
+};
+const int SHADER_PROGRAMS = sizeof(shader_programs)/sizeof(shader_programs[0]);
+
+/* Point a program's uniform blocks at the shared buffers, after every
+   (re)link; blocks the program does not use are skipped */
+void bindProgramBlocks (GLuint program)
+{
+  // VP comes from the camera block, model matrices from the per-frame objects block
+  bindUniformBlock(program, "Camera", CAMERA_BLOCK_BINDING);
+  bindUniformBlock(program, "Objects", OBJECTS_BLOCK_BINDING);
+}
+
+/* Start watching every shader file for --watch-shaders */
+bool watchShaderFiles ()
+{
+  std::vector<std::string> paths;
+  int p;
+  for (p=0;p<SHADER_PROGRAMS;p++) {
+    const char* files[2] = { shader_programs[p].VertexPath, shader_programs[p].FragmentPath };
+    int f;
+    for (f=0;f<2;f++)
+      if (find(paths.begin(), paths.end(), files[f]) == paths.end())
+        paths.push_back(files[f]);
+  }
+  return startShaderWatch(paths);
+}
+
+static const ShaderFile* findShaderFile (const std::vector<ShaderFile>& files, const char* path)
+{
+  size_t i;
+  for (i=0;i<files.size();i++)
+    if (files[i].path == path)
+      return &files[i];
+  return NULL;
+}
+
+/* Outcome of a hot reload. Programs are reloaded on the render thread, but
+   only the main thread may log (logger.h), so the outcomes wait here until
+   logShaderReloads(). */
+struct ShaderReload {
+  const ShaderProgram* program;
+  bool built;
+};
+typedef struct ShaderReload ShaderReload;
+
+static std::mutex reload_lock;
+static std::vector<ShaderReload> shader_reloads;
+
+static void reportShaderReload (const ShaderProgram& program, bool built)
+{
+  ShaderReload reload = { &program, built };
+  lock_guard<mutex> guard(reload_lock);
+  shader_reloads.push_back(reload);
+}
+
+/* Log the reloads reported since the last call; main thread only */
+void logShaderReloads ()
+{
+  std::vector<ShaderReload> reloads;
+  {
+    lock_guard<mutex> guard(reload_lock);
+    reloads.swap(shader_reloads);
+  }
+  size_t i;
+  for (i=0;i<reloads.size();i++) {
+    const ShaderProgram& program = *reloads[i].program;
+    if (reloads[i].built)
+      logMessage(LOG_INFO, "reloaded %s + %s", program.VertexPath, program.FragmentPath);
+    else
+      logMessage(LOG_WARN, "%s + %s failed to build, keeping the previous program", program.VertexPath, program.FragmentPath);
+  }
+}
+
+/* At a frame boundary, rebuild the programs whose files changed on disk.
+   The sources were already read by the watcher thread. A program that fails
+   to build keeps running the previous version. */
+void reloadChangedShaders ()
+{
+  static std::vector<ShaderFile> files;
+  if (!takeShaderChanges(files))
+    return;
+  int p;
+  for (p=0;p<SHADER_PROGRAMS;p++) {
+    const ShaderProgram& program = shader_programs[p];
+    const ShaderFile* vertex = findShaderFile(files, program.VertexPath);
+    const ShaderFile* fragment = findShaderFile(files, program.FragmentPath);
+    if (!vertex || !fragment || !(vertex->changed || fragment->changed))
+      continue;
+    GLuint id = BuildProgram(vertex->source, fragment->source, program.VertexPath, program.FragmentPath);
+    if (!id) {
+      reportShaderReload(program, false);
+      continue;
+    }
+    glDeleteProgram(*program.ID);
+    *program.ID = id;
+    bindProgramBlocks(id);
+    reportShaderReload(program, true);
+  }
+}
+
 /* Initialize the OpenGL rendering properties */
 /* Add all the models to be created here */
 void initGL (GLFWwindow* window, int width, int height)
 {
   /* Objects should be created before any other gl function and shaders */
+  // A new context: nothing is known about its state yet
+  resetGLState ();
   // Create the models
   //createTriangle (); // Generate the VAO, VBOs, vertices data & copy into the array buffer
-  createRectangle1 ();createRectangle2 ();
-  createLine ();
-  createGun1 ();createGun2 ();
-  createBlock1 ();createBlock2 ();createBlock3 ();
-  createLaser (); createMirror1(); createMirror2();
+  initMeshRegistry ();
+  createScene ();
+  createBlocks ();
+  createParticles ();
+  // Send all the meshes to the GPU in one buffer
+  uploadMeshes ();
   //drawCircle(0,0,0,5,360);
-  // Create and compile our GLSL program from the shaders
-  programID = LoadShaders( "Sample_GL.vert", "Sample_GL.frag" );
-  // Get a handle for our "MVP" uniform
-  Matrices.MatrixID = glGetUniformLocation(programID, "MVP");
-
+  // Create and compile our GLSL program from the shaders, or load them from the cache
+  initShaderCache (shader_cache_dir);
+  int p;
+  for (p=0;p<SHADER_PROGRAMS;p++) {
+    *shader_programs[p].ID = LoadShaders(shader_programs[p].VertexPath, shader_programs[p].FragmentPath);
+    bindProgramBlocks(*shader_programs[p].ID);
+  }
 
+  initCamera ();
+  createStreamBuffer (Stream, STREAM_REGION_SIZE);
+  initObjectQueue ();
   reshapeWindow (window, width, height);
 
   // Background color of the scene
-  glClearColor (0.7f, 0.7f, 0.7f, 0.0f); // R, G, B, A
+  glClearColor (BACKGROUND_GRAY, BACKGROUND_GRAY, BACKGROUND_GRAY, 0.0f); // R, G, B, A
   glClearDepth (1.0f);
 
-  glEnable (GL_DEPTH_TEST);
-  glDepthFunc (GL_LEQUAL);
+  setDepthTest (true);
+  setDepthFunc (GL_LEQUAL);
 
   cout << "VENDOR: " << glGetString(GL_VENDOR) << endl;
   cout << "RENDERER: " << glGetString(GL_RENDERER) << endl;
   cout << "VERSION: " << glGetString(GL_VERSION) << endl;
   cout << "GLSL: " << glGetString(GL_SHADING_LANGUAGE_VERSION) << endl;
 }
+/* --offscreen: render without a window, one tick per frame, and save every
+   frame as an image in 'dir'. Frame N shows the game after N ticks of the
+   replay being played back, or of the seed with no input. */
+int renderOffscreen (const char* dir, int frames, int width, int height, unsigned int seed)
+{
+  if (!createOffscreenContext(width, height))
+    return 1;
+  initGL (NULL, width, height);
+  if (!initFrameCapture(width, height, dir))
+    return 1;
+
+  resetGame(seed);
+  takeGLStateCounts();
+  int frame;
+  for (frame=0;frame<frames && !game_over;frame++) {
+    if (frame > 0) {
+      if (playing_back)
+        playbackActions();
+      update();
+      updateParticles(particles, TICK_DT);
+    }
+    // The latest tick exactly, there is nothing to blend with
+    draw(1);
+    // Queued behind the frame's draws; the pixels are written out later
+    captureFrame(frame);
+    streamEndFrame(Stream);
+  }
+  GLStateCounts calls = takeGLStateCounts();
+  int written = finishFrameCapture();
+  destroyOffscreenContext();
+  printf("wrote %d frames to %s\n", written, dir);
+  if (frame > 0)
+    printf("gl state calls per frame: %.1f issued, %.1f elided\n", (double)calls.issued/frame, (double)calls.elided/frame);
+  return written == frame ? 0 : 1;
+}
+
+/* Canonical scenes for --render-check: a seed, player actions and the tick
+   to look at. Actions of a step are pressed before that tick is simulated. */
+struct SceneStep {
+  int tick;
+  int action;
+  int repeat;
+};
+typedef struct SceneStep SceneStep;
+
+const int MAX_SCENE_STEPS = 4;
+
+struct RenderScene {
+  const char* name;
+  unsigned int seed;
+  int ticks;
+  SceneStep steps[MAX_SCENE_STEPS];   // unused entries have repeat 0
+};
+typedef struct RenderScene RenderScene;
+
+const RenderScene render_scenes[] = {
+  // Starting layout, blocks still above the screen
+  { "initial", 1, 0, {} },
+  // Blocks of all three kinds on screen, none caught yet
+  { "falling-blocks", 1, 700, {} },
+  // Gun raised and tilted so the shot bounces off mirror1, then mirror2
+  { "laser-mirrors", 1, 3, { { 0, ACTION_GUN_UP, 4 }, { 0, ACTION_GUN_TILT_UP, 6 }, { 0, ACTION_FIRE, 1 } } },
+  // Red basket at its left limit, green basket at its right limit
+  { "baskets-limits", 1, 2, { { 0, ACTION_RED_BASKET_LEFT, 30 }, { 0, ACTION_GREEN_BASKET_RIGHT, 30 } } }
+};
+const int RENDER_SCENES = sizeof(render_scenes)/sizeof(render_scenes[0]);
+
+/* Largest share of pixels that may differ before a scene fails */
+const float DIFF_MAX_PIXELS = 0.001;
+
+static void applySceneSteps (const RenderScene& scene, int tick)
+{
+  int k, n;
+  for (k=0;k<MAX_SCENE_STEPS;k++)
+    if (scene.steps[k].tick == tick)
+      for (n=0;n<scene.steps[k].repeat;n++)
+        gameAction(scene.steps[k].action);
+}
+
+/* Render one scene into out_dir, then compare it with the golden image, or
+   make it the golden image. Runs in its own process, with its own context.
+   Returns 0 if it matches, 1 if not, 2 on errors. */
+int checkScene (const RenderScene& scene, const char* golden_dir, const char* out_dir, bool update_goldens,
+                float threshold, int width, int height, FILE* report)
+{
+  if (!createOffscreenContext(width, height))
+    return 2;
+  initGL (NULL, width, height);
+  const char* dir = update_goldens ? golden_dir : out_dir;
+  if (!initFrameCapture(width, height, dir))
+    return 2;
+
+  resetGame(scene.seed);
+  int tick;
+  for (tick=0;tick<scene.ticks;tick++) {
+    applySceneSteps(scene, tick);
+    update();
+    updateParticles(particles, TICK_DT);
+  }
+  draw(1);
+  captureFrameAs(scene.name);
+  int written = finishFrameCapture();
+  destroyOffscreenContext();
+  if (written != 1)
+    return 2;
+  if (update_goldens) {
+    fprintf(report, "%-16s updated\n", scene.name);
+    return 0;
+  }
+
+  std::string golden_path = std::string(golden_dir) + "/" + scene.name + ".ppm";
+  std::string out_path = std::string(out_dir) + "/" + scene.name + ".ppm";
+  Image golden, rendered, diff;
+  if (!readPPM(golden_path.c_str(), golden)) {
+    fprintf(report, "%-16s no golden image %s\n", scene.name, golden_path.c_str());
+    return 2;
+  }
+  if (!readPPM(out_path.c_str(), rendered))
+    return 2;
+  int differing = compareImages(rendered, golden, threshold, &diff);
+  int allowed = (int)(DIFF_MAX_PIXELS * width * height);
+  if (differing >= 0 && differing <= allowed) {
+    fprintf(report, "%-16s ok (%d pixels differ)\n", scene.name, differing);
+    return 0;
+  }
+  std::string diff_path = std::string(out_dir) + "/" + scene.name + ".diff.ppm";
+  if (differing >= 0)
+    writePPM(diff_path.c_str(), diff);
+  if (differing < 0)
+    fprintf(report, "%-16s FAILED: size %dx%d, golden is %dx%d\n", scene.name, rendered.width, rendered.height, golden.width, golden.height);
+  else
+    fprintf(report, "%-16s FAILED: %d pixels differ (at most %d allowed), see %s\n", scene.name, differing, allowed, diff_path.c_str());
+  return 1;
+}
+
+/* --render-check: every scene in parallel, one process each since a GL
+   context cannot be shared between threads that render at the same time */
+int renderCheck (const char* golden_dir, bool update_goldens, float threshold, int width, int height)
+{
+  const char* out_dir = "render_check";
+  mkdir(out_dir, 0755);
+  // A check only reads the goldens; a missing directory fails every scene
+  if (update_goldens)
+    mkdir(golden_dir, 0755);
+  fflush(stdout);
+  pid_t children[RENDER_SCENES];
+  int i;
+  for (i=0;i<RENDER_SCENES;i++) {
+    children[i] = fork();
+    if (children[i] == 0) {
+      // Keep the child's GL and shader chatter out of the report
+      FILE* report = fdopen(dup(fileno(stdout)), "w");
+      if (!report || !freopen("/dev/null", "w", stdout) || !freopen("/dev/null", "w", stderr))
+        _exit(2);
+      int status = checkScene(render_scenes[i], golden_dir, out_dir, update_goldens, threshold, width, height, report);
+      fclose(report);
+      _exit(status);
+    }
+    if (children[i] < 0)
+      perror("fork");
+  }
+  int failed = 0;
+  for (i=0;i<RENDER_SCENES;i++) {
+    int status = 0;
+    if (children[i] < 0 || waitpid(children[i], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+      failed++;
+  }
+  printf("render check: %d of %d scenes %s\n", RENDER_SCENES - failed, RENDER_SCENES, update_goldens ? "updated" : "passed");
+  return failed ? 1 : 0;
+}
+
+/* The window the render thread draws into */
+GLFWwindow* render_window;
+
+/* Profile summary for the window title, left by the render thread for the
+   main thread, which owns the window; empty once shown */
+static std::mutex title_lock;
+static std::string window_title;
+static double title_time = 0;
+
+void attachRenderer ()
+{
+  glfwMakeContextCurrent(render_window);
+}
+
+void detachRenderer ()
+{
+  glfwMakeContextCurrent(NULL);
+}
+
+/* One frame on the render thread: submit the commands, present, profile */
+void renderFrame (RenderFrame& frame)
+{
+  // Swap in edited shaders between frames, never in the middle of one
+  reloadChangedShaders();
+
+  // OpenGL Draw commands; building them was timed by the main loop
+  profileAdd(PROFILE_SIM, frame.sim_ms);
+  profileAdd(PROFILE_DRAW, frame.build_ms);
+  profileBegin(PROFILE_DRAW);
+  gpuTimerBegin();
+  submitFrame(frame);
+  gpuTimerEnd();
+  streamEndFrame(Stream);
+  profileEnd(PROFILE_DRAW);
+  GLStateCounts calls = takeGLStateCounts();
+  profileStateCalls(calls.issued, calls.elided);
+
+  // Swap Frame Buffer in double buffering
+  profileBegin(PROFILE_SWAP);
+  glfwSwapBuffers(render_window);
+  profileEnd(PROFILE_SWAP);
+  profileEndFrame(frame.ticks);
+
+  double now = glfwGetTime();
+  if (now - title_time >= 0.5) {
+    char title[256];
+    profileSummary(title, sizeof(title));
+    lock_guard<mutex> guard(title_lock);
+    window_title = title;
+    title_time = now;
+  }
+}
+
 int main (int argc, char** argv)
 {
 	int width = 750;
 	int height = 650;
 
+  unsigned int seed = time(NULL);
+  const char* record_path = NULL;
+  const char* profile_path = NULL;
+  bool watch_shaders = false;
+  const char* offscreen_dir = NULL;
+  int offscreen_frames = 300;
+  const char* golden_dir = NULL;
+  bool update_goldens = false;
+  float diff_threshold = DIFF_THRESHOLD;
+  int threads = 0;
+  bool render_thread = true;
+  int i;
+  for (i=1;i<argc;i++)
+  {
+    if (!strcmp(argv[i], "--seed") && i+1<argc)
+      seed = strtoul(argv[++i], NULL, 10);
+    else if (!strcmp(argv[i], "--blocks") && i+1<argc)
+      setBlockCount(atoi(argv[++i]));
+    else if (!strcmp(argv[i], "--record") && i+1<argc)
+      record_path = argv[++i];
+    else if (!strcmp(argv[i], "--replay") && i+1<argc) {
+      if (!loadReplay(argv[++i], playback))
+        return 1;
+      playing_back = true;
+      seed = playback.seed;
+    }
+    else if (!strcmp(argv[i], "--shader-cache") && i+1<argc)
+      shader_cache_dir = argv[++i];
+    else if (!strcmp(argv[i], "--no-shader-cache"))
+      shader_cache_dir = NULL;
+    else if (!strcmp(argv[i], "--watch-shaders"))
+      watch_shaders = true;
+    else if (!strcmp(argv[i], "--offscreen") && i+1<argc)
+      offscreen_dir = argv[++i];
+    else if (!strcmp(argv[i], "--frames") && i+1<argc)
+      offscreen_frames = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--render-check") && i+1<argc)
+      golden_dir = argv[++i];
+    else if (!strcmp(argv[i], "--update-goldens"))
+      update_goldens = true;
+    else if (!strcmp(argv[i], "--diff-threshold") && i+1<argc)
+      diff_threshold = atof(argv[++i]);
+    else if (!strcmp(argv[i], "--threads") && i+1<argc)
+      threads = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--no-render-thread"))
+      render_thread = false;
+    else if (!strcmp(argv[i], "--profile-csv") && i+1<argc)
+      profile_path = argv[++i];
+    else if (!strcmp(argv[i], "--log-level") && i+1<argc && parseLogLevel(argv[i+1]) >= 0)
+      setLogLevel(parseLogLevel(argv[++i]));
+    else {
+      fprintf(stderr, "usage: %s [--seed N] [--blocks N] [--record file | --replay file] [--shader-cache dir | --no-shader-cache] [--watch-shaders] [--offscreen dir [--frames N]] [--render-check golden_dir [--update-goldens] [--diff-threshold T]] [--threads N] [--no-render-thread] [--profile-csv file] [--log-level debug|info|warn|error]\n", argv[0]);
+      return 1;
+    }
+  }
+  // A replay is only valid with the block count it was recorded with
+  if (playing_back)
+    setBlockCount(playback.blocks);
+  // Once, before any job can run the block update
+  selectBlockKernel(-1);
+
+  if (golden_dir)
+    return renderCheck(golden_dir, update_goldens, diff_threshold, width, height);
+  // Not before the render check: its forked scenes would not inherit the workers
+  startJobs(threads > 0 ? threads - 1 : -1);
+  if (offscreen_dir)
+    return renderOffscreen(offscreen_dir, offscreen_frames, width, height, seed);
+
   GLFWwindow* window = initGLFW(width, height);
 
   initGL (window, width, height);
+  initProfiler(profile_path != NULL);
+  if (watch_shaders && !watchShaderFiles())
+    fprintf(stderr, "shader hot reload unavailable\n");
+
+  startLogger(stdout);
+  logMessage(LOG_DEBUG, "seed %u", seed);
+  resetGame(seed);
+  int logged_points = points;
+  logMessage(LOG_INFO, "points: %d", points);
+  if (record_path && !startRecording(record_path, seed))
+    return 1;
+
+  // From here on the GL context belongs to the render thread
+  render_window = window;
+  glfwMakeContextCurrent(NULL);
+  RenderHooks hooks = { attachRenderer, renderFrame, detachRenderer };
+  startRenderThread(hooks, render_thread);
+
+  double previous_time = glfwGetTime();
+  double accumulator = 0;
 
-  double last_update_time = glfwGetTime(), current_time;
-  srand(time(NULL));
-  int x,y;
-  for (x=0;x<6;x++)
-  {
-    red_pos[x] = rand() % 10;
-    green_pos[x] = rand() % 10; 
-    black_pos[x] = rand() %10;
-  }
-  for(y=0;y<6;y++)
-  {
-    red_move[y]=4.2;
-    green_move[y]=4.2;
-    black_move[y]=4.2;
-  }
-  
   /* Draw in loop */
   while (!glfwWindowShouldClose(window)) {
 
-    // OpenGL Draw commands
-    draw();
-
-    // Swap Frame Buffer in double buffering
-    glfwSwapBuffers(window);
+    double current_time = glfwGetTime(); // Time in seconds
+    double frame_time = current_time - previous_time;
+    previous_time = current_time;
+    if (frame_time > MAX_FRAME_TIME)
+      frame_time = MAX_FRAME_TIME;
+
+    // Run as many fixed ticks as the elapsed time covers, whatever the refresh rate
+    accumulator += frame_time;
+    int ticks = 0;
+    while (accumulator >= TICK_DT && !game_over) {
+      if (playing_back)
+        playbackActions();
+      update();
+      // Only report the score when it changes, through the async logger
+      if (points != logged_points) {
+        logMessage(LOG_INFO, "points: %d", points);
+        logged_points = points;
+      }
+      accumulator -= TICK_DT;
+      ticks++;
+    }
+    // Effects are not part of the game, they follow the real frame time
+    updateParticles(particles, frame_time);
+    double sim_ms = (glfwGetTime() - current_time)*1000;
+    if (game_over)
+      break;
+
+    // Render commands blended between the last two ticks; the render thread
+    // draws them while the loop goes on with the next frame
+    RenderFrame& frame = beginRenderFrame();
+    double build_start = glfwGetTime();
+    buildFrame(frame, accumulator/TICK_DT);
+    frame.ticks = ticks;
+    frame.sim_ms = sim_ms;
+    frame.build_ms = (glfwGetTime() - build_start)*1000;
+    endRenderFrame();
 
     // Poll for Keyboard and mouse events
     glfwPollEvents();
 
-    // Control based on time (Time based transformation like 5 degrees rotation every 0.5s)
-    current_time = glfwGetTime(); // Time in seconds
-    if ((current_time - last_update_time) >= 0.5) { // atleast 0.5s elapsed since last frame
-      // do something every 0.5 seconds ..
-      last_update_time = current_time;
-    }     
+    // Frame timings left by the render thread, refreshed every 0.5s
+    {
+      lock_guard<mutex> guard(title_lock);
+      if (!window_title.empty()) {
+        glfwSetWindowTitle(window, window_title.c_str());
+        window_title.clear();
+      }
+    }
+    logShaderReloads();
   }
-
+  stopRenderThread();
+  logShaderReloads();
+
+  if (game_over)
+    logMessage(LOG_INFO, "game over after %u ticks, points: %d", game_tick, points);
+  stopRecording(game_tick, points);
+  stopShaderWatch();
+  stopJobs();
+  stopLogger();
+  if (profile_path)
+    writeProfileCSV(profile_path);
+  glfwDestroyWindow(window);
   glfwTerminate();
   //    exit(EXIT_SUCCESS);
 }
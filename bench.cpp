@@ -0,0 +1,384 @@
+#include <chrono>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <glm/glm.hpp>
+#include <glm/gtx/transform.hpp>
+#include "game.h"
+#include "block_kernel.h"
+#include "jobs.h"
+using namespace std;
+
+/* Micro-benchmarks of the simulation hot path, no window or GL context.
+   Every benchmark runs once per block count, on the same mid-game snapshot:
+     tick             - a whole update(), firing whenever the gun is ready
+     integrate/K      - integrateBlocks() with block kernel K
+     collision/grid   - the basket test of update(): catchCandidates()
+                        (grid query) then findCatches() (exact test)
+     collision/scan   - findCatches() on every block, as the test ran
+                        before the broadphase, for comparison
+     laser            - traceLaser() with the gun aimed off both mirrors
+     matrices         - a glm::translate * glm::rotate model matrix per
+                        block, as draw() builds them for single objects
+     ecs/move         - runSystems() with a system adding Velocity*dt to
+                        Transform over as many entities, spread over two
+                        archetypes: the iteration cost of any system
+   tick splits its block update across --threads job threads.
+   Results print as a table; --json also writes them in Google Benchmark's
+   JSON layout, so its tools (compare.py) can diff two commits. */
+
+const int DEFAULT_COUNTS[] = { 18, 1024, 16384, 131072, 1048576 };
+const double DEFAULT_MIN_TIME = 0.2;
+
+/* The snapshot: blocks sped up until the first bands are on screen */
+const float SNAPSHOT_SPEED = 0.1;
+const int SNAPSHOT_TICKS = 120;
+
+/* Gun aim of the laser benchmark: the shot bounces off mirror 1, then
+   mirror 2, then leaves the screen, unless a block is in the way */
+const float LASER_GUN_Y = 0.5;
+const float LASER_GUN_ROTATION = 36;
+
+struct BenchResult {
+  string name;
+  int blocks;
+  long long iterations;
+  double real_ns, cpu_ns;   // per iteration
+};
+typedef struct BenchResult BenchResult;
+
+/* Runs the benchmark body 'iterations' times */
+typedef void (*BenchFunc) (long long iterations);
+
+static double min_time = DEFAULT_MIN_TIME;
+static volatile float sink;   // keeps results from being optimized away
+
+/* Benchmark state outside the game's own */
+static vector<int> bench_candidates;
+static vector<int> bench_all_blocks;
+static vector<BlockCatch> bench_catches;
+static vector<glm::mat4> bench_matrices;
+static vector<float> bench_y;
+static vector<uint64_t> bench_in_play, bench_visible;
+static LaserBeam bench_beam;
+static World bench_world;
+
+static const char* filter = "";
+
+static bool selected (const char* name)
+{
+  return strstr(name, filter) != NULL;
+}
+
+static double cpuSeconds ()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+/* Reset the game with 'count' blocks and play it to the snapshot */
+static void prepareSnapshot (int count)
+{
+  setBlockCount(count);
+  resetGame(1);
+  speed = SNAPSHOT_SPEED;
+  int i;
+  for (i=0;i<SNAPSHOT_TICKS;i++)
+    update();
+}
+
+static void benchTick (long long iterations)
+{
+  long long i;
+  for (i=0;i<iterations;i++) {
+    gameAction(ACTION_FIRE);
+    update();
+  }
+  sink = points;
+}
+
+static void benchIntegrate (long long iterations)
+{
+  const BlockPool& b = block_pool;
+  long long i;
+  for (i=0;i<iterations;i++)
+    integrateBlocks(bench_y.data(), b.vy.data(), b.alive.data(), b.count, speed,
+                    BLOCK_BOTTOM, BLOCK_VISIBLE_TOP, bench_in_play.data(), bench_visible.data());
+  sink = bench_y[0];
+}
+
+static void benchCollisionGrid (long long iterations)
+{
+  size_t caught = 0;
+  long long i;
+  for (i=0;i<iterations;i++) {
+    catchCandidates(bench_candidates);
+    bench_catches.clear();
+    findCatches(bench_candidates, bench_catches);
+    caught += bench_catches.size();
+  }
+  sink = caught;
+}
+
+static void benchCollisionScan (long long iterations)
+{
+  size_t caught = 0;
+  long long i;
+  for (i=0;i<iterations;i++) {
+    bench_catches.clear();
+    findCatches(bench_all_blocks, bench_catches);
+    caught += bench_catches.size();
+  }
+  sink = caught;
+}
+
+static void benchLaser (long long iterations)
+{
+  int hits = 0;
+  long long i;
+  for (i=0;i<iterations;i++)
+    hits += traceLaser(bench_beam) >= 0;
+  sink = hits + bench_beam.vertices;
+}
+
+static void benchMatrices (long long iterations)
+{
+  const BlockPool& b = block_pool;
+  float angle = rectangle_rotation*M_PI/180.0f;
+  long long i;
+  for (i=0;i<iterations;i++) {
+    int id;
+    for (id=0;id<b.count;id++)
+      bench_matrices[id] = glm::translate(glm::vec3(b.x[id], b.y[id], 0)) * glm::rotate(angle, glm::vec3(0,0,1));
+  }
+  sink = bench_matrices[b.count-1][3][0];
+}
+
+static void moveSystem (Archetype& archetype, float dt)
+{
+  Transform* t = (Transform*)column(archetype, COMPONENT_TRANSFORM);
+  const Velocity* v = (const Velocity*)column(archetype, COMPONENT_VELOCITY);
+  int i;
+  for (i=0;i<archetype.count;i++) {
+    t[i].x += v[i].vx*dt;
+    t[i].y += v[i].vy*dt;
+  }
+}
+
+/* 'count' moving entities, every fourth one also drawable */
+static void prepareWorld (int count)
+{
+  clearWorld(bench_world);
+  if (bench_world.systems.empty())
+    addSystem(bench_world, "move", PHASE_TICK, HAS_TRANSFORM | HAS_VELOCITY, moveSystem);
+  int i;
+  for (i=0;i<count;i++) {
+    Entity e = createEntity(bench_world, HAS_TRANSFORM | HAS_VELOCITY | (i % 4 ? 0 : HAS_RENDERABLE));
+    ((Velocity*)getComponent(bench_world, e, COMPONENT_VELOCITY))->vy = -1;
+  }
+}
+
+static void benchEcs (long long iterations)
+{
+  long long i;
+  for (i=0;i<iterations;i++)
+    runSystems(bench_world, PHASE_TICK, TICK_DT);
+  sink = ((Transform*)column(bench_world.archetypes[0], COMPONENT_TRANSFORM))->y;
+}
+
+/* Grow the iteration count until one run takes at least min_time */
+static BenchResult runBench (const char* name, int blocks, BenchFunc func)
+{
+  BenchResult r;
+  r.name = string(name) + "/" + to_string(blocks);
+  r.blocks = blocks;
+  long long iterations = 1;
+  while (true) {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    double cpu_start = cpuSeconds();
+    func(iterations);
+    double cpu = cpuSeconds() - cpu_start;
+    double real = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if (real >= min_time || iterations >= 1000000000) {
+      r.iterations = iterations;
+      r.real_ns = real*1e9/iterations;
+      r.cpu_ns = cpu*1e9/iterations;
+      break;
+    }
+    // Aim 40% past the goal, but grow at most tenfold on a noisy short run
+    double factor = real > 0 ? min_time*1.4/real : 10;
+    if (factor > 10)
+      factor = 10;
+    long long next = (long long)(iterations*factor);
+    iterations = next > iterations ? next : iterations+1;
+  }
+  printf("%-22s %14.1f ns %14.1f ns %9.2f ns/block %12lld\n", r.name.c_str(), r.real_ns, r.cpu_ns, r.real_ns/blocks, r.iterations);
+  fflush(stdout);
+  return r;
+}
+
+/* 's' as a quoted JSON string: quotes, backslashes and control characters
+   escaped */
+static void writeJSONString (FILE* f, const char* s)
+{
+  fputc('"', f);
+  for (;*s;s++) {
+    unsigned char c = *s;
+    if (c == '"' || c == '\\')
+      fprintf(f, "\\%c", c);
+    else if (c < 0x20)
+      fprintf(f, "\\u%04x", c);
+    else
+      fputc(c, f);
+  }
+  fputc('"', f);
+}
+
+static bool writeJSON (const char* path, const vector<BenchResult>& results, const char* label, char** argv)
+{
+  FILE* f = fopen(path, "w");
+  if (!f) {
+    fprintf(stderr, "cannot write %s\n", path);
+    return false;
+  }
+  char date[64], host[256] = "";
+  time_t now = time(NULL);
+  strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", localtime(&now));
+  gethostname(host, sizeof(host)-1);
+  fprintf(f, "{\n  \"context\": {\n");
+  fprintf(f, "    \"date\": \"%s\",\n    \"host_name\": ", date);
+  writeJSONString(f, host);
+  fprintf(f, ",\n    \"executable\": ");
+  writeJSONString(f, argv[0]);
+  fprintf(f, ",\n");
+  fprintf(f, "    \"num_cpus\": %ld,\n    \"block_kernel\": \"%s\",\n", sysconf(_SC_NPROCESSORS_ONLN), blockKernelName(selectBlockKernel(-1)));
+  fprintf(f, "    \"threads\": %d,\n", jobThreads());
+  fprintf(f, "    \"label\": ");
+  writeJSONString(f, label);
+  fprintf(f, ",\n    \"library_build_type\": \"release\"\n  },\n");
+  fprintf(f, "  \"benchmarks\": [\n");
+  size_t i;
+  for (i=0;i<results.size();i++) {
+    const BenchResult& r = results[i];
+    fprintf(f, "    {\n      \"name\": \"%s\",\n      \"run_name\": \"%s\",\n      \"run_type\": \"iteration\",\n", r.name.c_str(), r.name.c_str());
+    fprintf(f, "      \"iterations\": %lld,\n      \"real_time\": %.3f,\n      \"cpu_time\": %.3f,\n      \"time_unit\": \"ns\",\n", r.iterations, r.real_ns, r.cpu_ns);
+    fprintf(f, "      \"blocks\": %d,\n      \"items_per_second\": %.1f\n    }%s\n", r.blocks, r.blocks*1e9/r.real_ns, i+1 < results.size() ? "," : "");
+  }
+  fprintf(f, "  ]\n}\n");
+  return fclose(f) == 0;
+}
+
+void usage (const char* name)
+{
+  fprintf(stderr, "usage: %s [--counts N,N,...] [--filter text] [--min-time S] [--threads N] [--json file] [--label text]\n", name);
+  fprintf(stderr, "  --counts N,...  block counts to run every benchmark at (default 18,1024,16384,131072,1048576)\n");
+  fprintf(stderr, "  --filter text   only benchmarks whose name contains text\n");
+  fprintf(stderr, "  --min-time S    seconds each measurement runs for at least (default %g)\n", DEFAULT_MIN_TIME);
+  fprintf(stderr, "  --threads N     job threads, 0 for one per core (default 0)\n");
+  fprintf(stderr, "  --json file     also write the results as JSON\n");
+  fprintf(stderr, "  --label text    stored in the JSON context, e.g. the commit hash\n");
+}
+
+int main (int argc, char** argv)
+{
+  vector<int> counts(DEFAULT_COUNTS, DEFAULT_COUNTS + sizeof(DEFAULT_COUNTS)/sizeof(DEFAULT_COUNTS[0]));
+  const char* json_path = NULL;
+  const char* label = "";
+  int threads = 0;
+  int i;
+  for (i=1;i<argc;i++)
+  {
+    if (!strcmp(argv[i], "--counts") && i+1<argc) {
+      counts.clear();
+      char* p = argv[++i];
+      while (*p) {
+        int n = strtol(p, &p, 10);
+        if (n > 0)
+          counts.push_back(n);
+        if (*p == ',')
+          p++;
+        else if (*p) {
+          usage(argv[0]);
+          return 1;
+        }
+      }
+    }
+    else if (!strcmp(argv[i], "--filter") && i+1<argc)
+      filter = argv[++i];
+    else if (!strcmp(argv[i], "--min-time") && i+1<argc)
+      min_time = atof(argv[++i]);
+    else if (!strcmp(argv[i], "--threads") && i+1<argc)
+      threads = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--json") && i+1<argc)
+      json_path = argv[++i];
+    else if (!strcmp(argv[i], "--label") && i+1<argc)
+      label = argv[++i];
+    else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (counts.empty()) {
+    usage(argv[0]);
+    return 1;
+  }
+  selectBlockKernel(-1);
+  startJobs(threads > 0 ? threads - 1 : -1);
+
+  printf("%-22s %17s %17s %18s %12s\n", "benchmark", "real/iter", "cpu/iter", "real/block", "iterations");
+  vector<BenchResult> results;
+  size_t c;
+  for (c=0;c<counts.size();c++)
+  {
+    int n = counts[c];
+    if (selected("tick")) {
+      prepareSnapshot(n);
+      results.push_back(runBench("tick", n, benchTick));
+    }
+
+    prepareSnapshot(n);
+    n = block_pool.count;   // at least one block of each kind
+    int k;
+    for (k=0;k<BLOCK_KERNELS;k++) {
+      string name = string("integrate/") + blockKernelName(k);
+      if (!selected(name.c_str()) || selectBlockKernel(k) != k)
+        continue;
+      bench_y = block_pool.y;
+      bench_in_play.assign(block_pool.in_play.size(), 0);
+      bench_visible.assign(block_pool.visible.size(), 0);
+      results.push_back(runBench(name.c_str(), n, benchIntegrate));
+    }
+    selectBlockKernel(-1);
+
+    if (selected("collision/grid"))
+      results.push_back(runBench("collision/grid", n, benchCollisionGrid));
+    if (selected("collision/scan")) {
+      bench_all_blocks.resize(n);
+      for (k=0;k<n;k++)
+        bench_all_blocks[k] = k;
+      results.push_back(runBench("collision/scan", n, benchCollisionScan));
+    }
+    if (selected("laser")) {
+      transformOf(gun).y = LASER_GUN_Y;
+      transformOf(gun).rotation = LASER_GUN_ROTATION;
+      results.push_back(runBench("laser", n, benchLaser));
+    }
+    if (selected("matrices")) {
+      bench_matrices.resize(n);
+      results.push_back(runBench("matrices", n, benchMatrices));
+    }
+    if (selected("ecs/move")) {
+      prepareWorld(n);
+      results.push_back(runBench("ecs/move", n, benchEcs));
+    }
+  }
+
+  if (json_path && !writeJSON(json_path, results, label, argv))
+    return 1;
+  return 0;
+}
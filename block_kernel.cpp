@@ -0,0 +1,160 @@
+#include <string.h>
+#include "block_kernel.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BLOCK_KERNEL_X86
+#include <immintrin.h>
+#endif
+
+typedef void (*IntegrateFunc) (float*, const float*, const unsigned char*, int, float, float, float, uint64_t*, uint64_t*);
+
+/* Remaining blocks [start, n) one at a time; also the whole scalar kernel.
+   'start' is a multiple of 64, so these blocks fill whole words. */
+static void integrateTail (float* y, const float* vy, const unsigned char* alive, int start, int n, float speed,
+                           float bottom, float top, uint64_t* in_play, uint64_t* visible)
+{
+  int word;
+  for (word=start;word<n;word+=64) {
+    int end = n - word < 64 ? n - word : 64;
+    uint64_t play = 0, vis = 0;
+    int k;
+    for (k=0;k<end;k++) {
+      float v = y[word+k] + vy[word+k]*speed;
+      y[word+k] = v;
+      // Nearly all blocks are alive and above the bottom, so these branches
+      // predict well
+      if (alive[word+k] && v >= bottom) {
+        play |= (uint64_t)1 << k;
+        if (v <= top)
+          vis |= (uint64_t)1 << k;
+      }
+    }
+    in_play[word >> 6] = play;
+    visible[word >> 6] = vis;
+  }
+}
+
+static void integrateScalar (float* y, const float* vy, const unsigned char* alive, int n, float speed,
+                             float bottom, float top, uint64_t* in_play, uint64_t* visible)
+{
+  integrateTail(y, vy, alive, 0, n, speed, bottom, top, in_play, visible);
+}
+
+#ifdef BLOCK_KERNEL_X86
+
+/* Live bits of 16 consecutive blocks */
+static inline unsigned int aliveBits16 (const unsigned char* alive)
+{
+  __m128i dead = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)alive), _mm_setzero_si128());
+  return ~_mm_movemask_epi8(dead) & 0xffff;
+}
+
+/* SSE2 is part of x86-64, so this one needs no target attribute */
+static void integrateSSE2 (float* y, const float* vy, const unsigned char* alive, int n, float speed,
+                           float bottom, float top, uint64_t* in_play, uint64_t* visible)
+{
+  const __m128 s = _mm_set1_ps(speed), lo = _mm_set1_ps(bottom), hi = _mm_set1_ps(top);
+  int full = n & ~63;
+  int i;
+  for (i=0;i<full;i+=16) {
+    unsigned int play = 0, vis = 0;
+    int k;
+    for (k=0;k<16;k+=4) {
+      __m128 v = _mm_add_ps(_mm_loadu_ps(y+i+k), _mm_mul_ps(_mm_loadu_ps(vy+i+k), s));
+      _mm_storeu_ps(y+i+k, v);
+      play |= _mm_movemask_ps(_mm_cmpge_ps(v, lo)) << k;
+      vis |= _mm_movemask_ps(_mm_cmple_ps(v, hi)) << k;
+    }
+    play &= aliveBits16(alive+i);
+    in_play[i >> 6] |= (uint64_t)play << (i & 63);
+    visible[i >> 6] |= (uint64_t)(play & vis) << (i & 63);
+  }
+  integrateTail(y, vy, alive, full, n, speed, bottom, top, in_play, visible);
+}
+
+__attribute__((target("avx2")))
+static void integrateAVX2 (float* y, const float* vy, const unsigned char* alive, int n, float speed,
+                           float bottom, float top, uint64_t* in_play, uint64_t* visible)
+{
+  const __m256 s = _mm256_set1_ps(speed), lo = _mm256_set1_ps(bottom), hi = _mm256_set1_ps(top);
+  int full = n & ~63;
+  int i;
+  for (i=0;i<full;i+=32) {
+    __m256i dead = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(alive+i)), _mm256_setzero_si256());
+    unsigned int live = ~(unsigned int)_mm256_movemask_epi8(dead);
+    unsigned int play = 0, vis = 0;
+    int k;
+    for (k=0;k<32;k+=8) {
+      // Explicit mul then add: an FMA would round differently from the other kernels
+      __m256 v = _mm256_add_ps(_mm256_loadu_ps(y+i+k), _mm256_mul_ps(_mm256_loadu_ps(vy+i+k), s));
+      _mm256_storeu_ps(y+i+k, v);
+      play |= (unsigned int)_mm256_movemask_ps(_mm256_cmp_ps(v, lo, _CMP_GE_OQ)) << k;
+      vis |= (unsigned int)_mm256_movemask_ps(_mm256_cmp_ps(v, hi, _CMP_LE_OQ)) << k;
+    }
+    play &= live;
+    in_play[i >> 6] |= (uint64_t)play << (i & 63);
+    visible[i >> 6] |= (uint64_t)(play & vis) << (i & 63);
+  }
+  integrateTail(y, vy, alive, full, n, speed, bottom, top, in_play, visible);
+}
+
+#endif
+
+static bool kernelSupported (int kernel)
+{
+  switch (kernel) {
+    case KERNEL_SCALAR: return true;
+#ifdef BLOCK_KERNEL_X86
+    case KERNEL_SSE2: return __builtin_cpu_supports("sse2");
+    case KERNEL_AVX2: return __builtin_cpu_supports("avx2");
+#endif
+    default: return false;
+  }
+}
+
+static IntegrateFunc integrate_func = NULL;
+
+int selectBlockKernel (int kernel)
+{
+  static const IntegrateFunc funcs[BLOCK_KERNELS] = {
+    integrateScalar,
+#ifdef BLOCK_KERNEL_X86
+    integrateSSE2,
+    integrateAVX2
+#else
+    NULL,
+    NULL
+#endif
+  };
+  if (kernel < 0 || kernel >= BLOCK_KERNELS || !kernelSupported(kernel)) {
+    kernel = BLOCK_KERNELS - 1;
+    while (!kernelSupported(kernel))
+      kernel--;
+  }
+  integrate_func = funcs[kernel];
+  return kernel;
+}
+
+const char* blockKernelName (int kernel)
+{
+  static const char* names[BLOCK_KERNELS] = { "scalar", "sse2", "avx2" };
+  return kernel >= 0 && kernel < BLOCK_KERNELS ? names[kernel] : "unknown";
+}
+
+int parseBlockKernel (const char* name)
+{
+  int i;
+  for (i=0;i<BLOCK_KERNELS;i++)
+    if (!strcmp(name, blockKernelName(i)))
+      return i;
+  return -1;
+}
+
+void integrateBlocks (float* y, const float* vy, const unsigned char* alive, int n, float speed,
+                      float bottom, float top, uint64_t* in_play, uint64_t* visible)
+{
+  size_t words = (n + 63) / 64;
+  memset(in_play, 0, words*sizeof(uint64_t));
+  memset(visible, 0, words*sizeof(uint64_t));
+  integrate_func(y, vy, alive, n, speed, bottom, top, in_play, visible);
+}
@@ -0,0 +1,35 @@
+#ifndef BLOCK_KERNEL_H
+#define BLOCK_KERNEL_H
+
+#include <stdint.h>
+
+/* The per-tick hot loop over the block pool: moves every block and
+   classifies it in the same pass. Implemented for AVX2, SSE2 and plain C;
+   the widest one the CPU supports is picked at runtime. All of them give
+   bit-identical results (separate multiply and add, no FMA), so replays
+   do not depend on the machine. */
+
+enum BlockKernel {
+  KERNEL_SCALAR,
+  KERNEL_SSE2,
+  KERNEL_AVX2,
+  BLOCK_KERNELS
+};
+
+/* Use 'kernel', or the best supported one if it is -1 or not supported.
+   Returns the kernel actually used. Must be called before the first
+   integrateBlocks(), and never while one runs: the job threads read the
+   choice without a lock. */
+int selectBlockKernel (int kernel);
+const char* blockKernelName (int kernel);
+/* Parse "scalar", "sse2" or "avx2", returns -1 if unknown */
+int parseBlockKernel (const char* name);
+
+/* For the first n blocks: y[i] += vy[i]*speed, then set bit i of
+   'in_play' if block i is alive and y[i] >= bottom, and bit i of 'visible'
+   if it is also at or below 'top'. Both masks hold (n+63)/64 words and
+   are overwritten; bits past n are cleared. */
+void integrateBlocks (float* y, const float* vy, const unsigned char* alive, int n, float speed,
+                      float bottom, float top, uint64_t* in_play, uint64_t* visible);
+
+#endif
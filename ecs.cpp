@@ -0,0 +1,233 @@
+#include <string.h>
+#include "ecs.h"
+
+static const size_t component_sizes[COMPONENT_TYPES] = {
+  sizeof(Transform),
+  sizeof(Velocity),
+  sizeof(Collider),
+  sizeof(Scoring),
+  sizeof(Renderable)
+};
+
+static inline int entityIndex (Entity entity)
+{
+  return entity & ENTITY_INDEX_MASK;
+}
+
+/* The record of a live entity, or NULL */
+static const EntityRecord* findRecord (const World& world, Entity entity)
+{
+  size_t index = entityIndex(entity);
+  if (entity == NO_ENTITY || index >= world.records.size())
+    return NULL;
+  const EntityRecord& record = world.records[index];
+  if (record.archetype < 0 || record.generation != (entity & ~ENTITY_INDEX_MASK))
+    return NULL;
+  return &record;
+}
+
+static int findOrAddArchetype (World& world, ComponentMask mask)
+{
+  size_t a;
+  for (a=0;a<world.archetypes.size();a++)
+    if (world.archetypes[a].mask == mask)
+      return a;
+  world.archetypes.push_back(Archetype());
+  Archetype& archetype = world.archetypes.back();
+  archetype.mask = mask;
+  archetype.count = 0;
+  return world.archetypes.size() - 1;
+}
+
+/* Append a row for 'entity' with default components */
+static int appendRow (Archetype& archetype, Entity entity)
+{
+  int row = archetype.count++;
+  archetype.entities.push_back(entity);
+  int type;
+  for (type=0;type<COMPONENT_TYPES;type++) {
+    if (!(archetype.mask & (1u << type)))
+      continue;
+    std::vector<unsigned char>& data = archetype.columns[type];
+    data.resize(data.size() + component_sizes[type], 0);
+  }
+  if (archetype.mask & HAS_TRANSFORM) {
+    Transform* t = (Transform*)column(archetype, COMPONENT_TRANSFORM) + row;
+    t->scale_x = t->scale_y = 1;
+  }
+  if (archetype.mask & HAS_RENDERABLE)
+    ((Renderable*)column(archetype, COMPONENT_RENDERABLE))[row].visible = true;
+  return row;
+}
+
+/* Move the last row into 'row' and drop the last row */
+static void removeRow (World& world, Archetype& archetype, int row)
+{
+  int last = --archetype.count;
+  int type;
+  for (type=0;type<COMPONENT_TYPES;type++) {
+    if (!(archetype.mask & (1u << type)))
+      continue;
+    std::vector<unsigned char>& data = archetype.columns[type];
+    size_t size = component_sizes[type];
+    if (row != last)
+      memcpy(&data[row*size], &data[last*size], size);
+    data.resize(last*size);
+  }
+  if (row != last) {
+    Entity moved = archetype.entities[last];
+    archetype.entities[row] = moved;
+    world.records[entityIndex(moved)].row = row;
+  }
+  archetype.entities.pop_back();
+}
+
+void clearWorld (World& world)
+{
+  world.archetypes.clear();
+  world.free_indices.clear();
+  size_t i;
+  for (i=0;i<world.records.size();i++) {
+    // Bump the generation so no old handle stays valid
+    if (world.records[i].archetype >= 0)
+      world.records[i].generation += 1u << ENTITY_INDEX_BITS;
+    world.records[i].archetype = -1;
+    world.free_indices.push_back(i);
+  }
+  world.live = 0;
+  for (i=0;i<world.systems.size();i++) {
+    world.systems[i].matches.clear();
+    world.systems[i].archetypes_seen = 0;
+  }
+}
+
+Entity createEntity (World& world, ComponentMask mask)
+{
+  int index;
+  if (!world.free_indices.empty()) {
+    index = world.free_indices.back();
+    world.free_indices.pop_back();
+  }
+  else {
+    if (world.records.size() > ENTITY_INDEX_MASK)
+      return NO_ENTITY;
+    index = world.records.size();
+    EntityRecord record = { -1, 0, 0 };
+    world.records.push_back(record);
+  }
+  EntityRecord& record = world.records[index];
+  Entity entity = record.generation | index;
+  record.archetype = findOrAddArchetype(world, mask);
+  record.row = appendRow(world.archetypes[record.archetype], entity);
+  world.live++;
+  return entity;
+}
+
+void destroyEntity (World& world, Entity entity)
+{
+  if (!findRecord(world, entity))
+    return;
+  EntityRecord& record = world.records[entityIndex(entity)];
+  removeRow(world, world.archetypes[record.archetype], record.row);
+  record.archetype = -1;
+  record.generation += 1u << ENTITY_INDEX_BITS;
+  world.free_indices.push_back(entityIndex(entity));
+  world.live--;
+}
+
+bool entityAlive (const World& world, Entity entity)
+{
+  return findRecord(world, entity) != NULL;
+}
+
+ComponentMask entityComponents (const World& world, Entity entity)
+{
+  const EntityRecord* record = findRecord(world, entity);
+  return record ? world.archetypes[record->archetype].mask : 0;
+}
+
+/* Move an entity to the archetype of 'mask', keeping the components both
+   archetypes have */
+static void changeArchetype (World& world, Entity entity, ComponentMask mask)
+{
+  if (!findRecord(world, entity))
+    return;
+  EntityRecord& record = world.records[entityIndex(entity)];
+  if (world.archetypes[record.archetype].mask == mask)
+    return;
+  // Adding an archetype may reallocate the array, so look both up after it
+  int target = findOrAddArchetype(world, mask);
+  Archetype& from = world.archetypes[record.archetype];
+  Archetype& to = world.archetypes[target];
+  int row = appendRow(to, entity);
+  int type;
+  for (type=0;type<COMPONENT_TYPES;type++)
+    if (from.mask & to.mask & (1u << type)) {
+      size_t size = component_sizes[type];
+      memcpy(&to.columns[type][row*size], &from.columns[type][record.row*size], size);
+    }
+  removeRow(world, from, record.row);
+  record.archetype = target;
+  record.row = row;
+}
+
+void addComponents (World& world, Entity entity, ComponentMask mask)
+{
+  changeArchetype(world, entity, entityComponents(world, entity) | mask);
+}
+
+void removeComponents (World& world, Entity entity, ComponentMask mask)
+{
+  changeArchetype(world, entity, entityComponents(world, entity) & ~mask);
+}
+
+void* getComponent (World& world, Entity entity, int type)
+{
+  const EntityRecord* record = findRecord(world, entity);
+  if (!record)
+    return NULL;
+  Archetype& archetype = world.archetypes[record->archetype];
+  if (!(archetype.mask & (1u << type)))
+    return NULL;
+  return &archetype.columns[type][record->row*component_sizes[type]];
+}
+
+void findArchetypes (const World& world, ComponentMask mask, std::vector<int>& out)
+{
+  out.clear();
+  size_t a;
+  for (a=0;a<world.archetypes.size();a++)
+    if ((world.archetypes[a].mask & mask) == mask)
+      out.push_back(a);
+}
+
+void addSystem (World& world, const char* name, int phase, ComponentMask mask, SystemFunc run)
+{
+  world.systems.push_back(System());
+  System& system = world.systems.back();
+  system.name = name;
+  system.phase = phase;
+  system.mask = mask;
+  system.run = run;
+  system.archetypes_seen = 0;
+}
+
+void runSystems (World& world, int phase, float dt)
+{
+  size_t s;
+  for (s=0;s<world.systems.size();s++) {
+    System& system = world.systems[s];
+    if (system.phase != phase)
+      continue;
+    // Archetypes are only ever appended, so only the new ones need checking
+    for (;system.archetypes_seen<world.archetypes.size();system.archetypes_seen++)
+      if ((world.archetypes[system.archetypes_seen].mask & system.mask) == system.mask)
+        system.matches.push_back(system.archetypes_seen);
+    size_t m;
+    for (m=0;m<system.matches.size();m++) {
+      Archetype& archetype = world.archetypes[system.matches[m]];
+      if (archetype.count > 0)
+        system.run(archetype, dt);
+    }
+  }
+}
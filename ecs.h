@@ -0,0 +1,148 @@
+#ifndef ECS_H
+#define ECS_H
+
+/* Entity-component storage for the game objects. Entities with the same set
+   of components share an archetype, which keeps each component in its own
+   dense array, one row per entity; systems walk those arrays front to back.
+   Adding or removing components moves the entity to another archetype,
+   destroying one swaps the archetype's last row into its place. No GL. */
+
+#include <vector>
+#include <stdint.h>
+
+/* Index into the world's entity table in the low bits, a generation count
+   in the high bits so handles to destroyed entities go stale */
+typedef uint32_t Entity;
+const int ENTITY_INDEX_BITS = 24;
+const Entity ENTITY_INDEX_MASK = (1u << ENTITY_INDEX_BITS) - 1;
+const Entity NO_ENTITY = 0xffffffff;
+
+enum ComponentType {
+  COMPONENT_TRANSFORM,
+  COMPONENT_VELOCITY,
+  COMPONENT_COLLIDER,
+  COMPONENT_SCORING,
+  COMPONENT_RENDERABLE,
+  COMPONENT_TYPES
+};
+
+/* A set of components, bit i for ComponentType i */
+typedef unsigned int ComponentMask;
+const ComponentMask HAS_TRANSFORM = 1u << COMPONENT_TRANSFORM;
+const ComponentMask HAS_VELOCITY = 1u << COMPONENT_VELOCITY;
+const ComponentMask HAS_COLLIDER = 1u << COMPONENT_COLLIDER;
+const ComponentMask HAS_SCORING = 1u << COMPONENT_SCORING;
+const ComponentMask HAS_RENDERABLE = 1u << COMPONENT_RENDERABLE;
+
+/* New components start zeroed, except the scale of a Transform (1) and the
+   visibility of a Renderable (true) */
+struct Transform {
+  float x, y;
+  float rotation;            // degrees about z
+  float scale_x, scale_y;
+};
+typedef struct Transform Transform;
+
+struct Velocity {
+  float vx, vy;              // units per second, a system adds v*dt to the position
+};
+typedef struct Velocity Velocity;
+
+/* Half extents around the transform's position. Doubles, so tests against
+   them round the same as the game's original literal bounds. */
+struct Collider {
+  double half_width, half_height;
+};
+typedef struct Collider Collider;
+
+/* Catches falling blocks of 'kind' (BlockKind) for points */
+struct Scoring {
+  int kind;
+};
+typedef struct Scoring Scoring;
+
+/* Drawn by the renderer with mesh number 'mesh', in increasing 'layer' */
+struct Renderable {
+  int mesh;
+  int layer;
+  bool visible;
+};
+typedef struct Renderable Renderable;
+
+struct Archetype {
+  ComponentMask mask;
+  int count;
+  std::vector<Entity> entities;                         // entity of each row
+  std::vector<unsigned char> columns[COMPONENT_TYPES];  // rows of each component in the mask
+};
+typedef struct Archetype Archetype;
+
+/* Systems run over every archetype that has all the components of their
+   mask, in the order they were added, grouped by phase */
+enum SystemPhase {
+  PHASE_TICK,      // from update(), once per simulation tick
+  PHASE_RENDER,    // from the renderer, once per frame
+  SYSTEM_PHASES
+};
+
+typedef void (*SystemFunc) (Archetype& archetype, float dt);
+
+struct System {
+  const char* name;
+  int phase;
+  ComponentMask mask;
+  SystemFunc run;
+  std::vector<int> matches;   // archetypes known to match
+  size_t archetypes_seen;     // archetypes checked so far
+};
+typedef struct System System;
+
+struct EntityRecord {
+  int archetype;   // -1 while the index is free
+  int row;
+  Entity generation;
+};
+typedef struct EntityRecord EntityRecord;
+
+/* Usable when zero-initialized, like a global, or after clearWorld() */
+struct World {
+  std::vector<Archetype> archetypes;   // never removed, so indices stay valid
+  std::vector<EntityRecord> records;   // indexed by entity index
+  std::vector<Entity> free_indices;
+  std::vector<System> systems;
+  int live;
+};
+typedef struct World World;
+
+/* Destroy every entity and forget the archetypes, keeping the systems */
+void clearWorld (World& world);
+
+Entity createEntity (World& world, ComponentMask mask);
+void destroyEntity (World& world, Entity entity);
+bool entityAlive (const World& world, Entity entity);
+ComponentMask entityComponents (const World& world, Entity entity);
+
+/* Add or remove components, moving the entity to the matching archetype.
+   Pointers from getComponent() or column() are invalid afterwards. */
+void addComponents (World& world, Entity entity, ComponentMask mask);
+void removeComponents (World& world, Entity entity, ComponentMask mask);
+
+/* The entity's component of 'type', or NULL if it has none; cast it to the
+   component's struct. Valid until entities are created, destroyed or
+   change components. */
+void* getComponent (World& world, Entity entity, int type);
+
+/* First row of a component in an archetype, 'count' rows long */
+inline void* column (Archetype& archetype, int type)
+{
+  return archetype.columns[type].empty() ? 0 : &archetype.columns[type][0];
+}
+
+/* Indices of the archetypes having every component of 'mask' */
+void findArchetypes (const World& world, ComponentMask mask, std::vector<int>& out);
+
+void addSystem (World& world, const char* name, int phase, ComponentMask mask, SystemFunc run);
+/* Run the systems of one phase, each over all of its archetypes */
+void runSystems (World& world, int phase, float dt);
+
+#endif
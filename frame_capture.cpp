@@ -0,0 +1,127 @@
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <glad/glad.h>
+#include "frame_capture.h"
+using namespace std;
+
+struct CaptureSlot {
+  GLuint PixelBuffer;
+  GLsync Fence;
+  string Name;   // empty when the slot holds no frame
+};
+typedef struct CaptureSlot CaptureSlot;
+
+static CaptureSlot slots[CAPTURE_BUFFERS];
+static int next_slot = 0;
+static int capture_width, capture_height;
+static string capture_dir;
+static vector<unsigned char> row;
+static int frames_written = 0;
+
+bool initFrameCapture (int width, int height, const char* dir)
+{
+  mkdir(dir, 0755);
+  struct stat info;
+  if (stat(dir, &info) != 0 || !S_ISDIR(info.st_mode)) {
+    fprintf(stderr, "frame capture: cannot create directory %s\n", dir);
+    return false;
+  }
+  capture_dir = dir;
+  capture_width = width;
+  capture_height = height;
+  row.resize(width*3);
+  frames_written = 0;
+  next_slot = 0;
+
+  int i;
+  for (i=0;i<CAPTURE_BUFFERS;i++) {
+    glGenBuffers(1, &slots[i].PixelBuffer);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slots[i].PixelBuffer);
+    glBufferData(GL_PIXEL_PACK_BUFFER, width*height*4, NULL, GL_STREAM_READ);
+    slots[i].Fence = 0;
+    slots[i].Name.clear();
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  return true;
+}
+
+/* Map a slot's pixels (waiting for them if 'wait') and write its frame */
+static bool writeSlot (CaptureSlot& slot, bool wait)
+{
+  if (slot.Name.empty())
+    return true;
+  GLenum status = glClientWaitSync(slot.Fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? GL_TIMEOUT_IGNORED : 0);
+  if (status == GL_TIMEOUT_EXPIRED)
+    return false;
+  glDeleteSync(slot.Fence);
+  slot.Fence = 0;
+
+  string path = capture_dir + "/" + slot.Name + ".ppm";
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.PixelBuffer);
+  const unsigned char* pixels = (const unsigned char*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, capture_width*capture_height*4, GL_MAP_READ_BIT);
+  FILE* f = pixels ? fopen(path.c_str(), "wb") : NULL;
+  if (f) {
+    // GL rows go bottom up, PPM rows top down; RGBA to RGB on the way
+    fprintf(f, "P6\n%d %d\n255\n", capture_width, capture_height);
+    int y, x;
+    for (y=capture_height-1;y>=0;y--) {
+      const unsigned char* src = pixels + y*capture_width*4;
+      for (x=0;x<capture_width;x++) {
+        row[x*3] = src[x*4];
+        row[x*3+1] = src[x*4+1];
+        row[x*3+2] = src[x*4+2];
+      }
+      fwrite(&row[0], 1, row.size(), f);
+    }
+    if (fclose(f) == 0)
+      frames_written++;
+  }
+  else
+    fprintf(stderr, "frame capture: cannot write %s\n", path.c_str());
+  if (pixels)
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  slot.Name.clear();
+  return true;
+}
+
+void captureFrameAs (const char* name)
+{
+  // Write whatever already arrived, oldest first, without waiting
+  int i;
+  for (i=0;i<CAPTURE_BUFFERS;i++)
+    if (!writeSlot(slots[(next_slot + i) % CAPTURE_BUFFERS], false))
+      break;
+
+  // Only blocks when the GPU is CAPTURE_BUFFERS frames behind
+  CaptureSlot& slot = slots[next_slot];
+  writeSlot(slot, true);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.PixelBuffer);
+  glPixelStorei(GL_PACK_ALIGNMENT, 4);
+  // Into the buffer object, so this returns without waiting for the pixels
+  glReadPixels(0, 0, capture_width, capture_height, GL_RGBA, GL_UNSIGNED_BYTE, (void*)0);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  slot.Fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  slot.Name = name;
+  next_slot = (next_slot + 1) % CAPTURE_BUFFERS;
+}
+
+void captureFrame (int frame)
+{
+  char name[32];
+  snprintf(name, sizeof(name), "frame_%05d", frame);
+  captureFrameAs(name);
+}
+
+int finishFrameCapture ()
+{
+  int i;
+  for (i=0;i<CAPTURE_BUFFERS;i++) {
+    CaptureSlot& slot = slots[(next_slot + i) % CAPTURE_BUFFERS];
+    writeSlot(slot, true);
+    glDeleteBuffers(1, &slot.PixelBuffer);
+  }
+  return frames_written;
+}
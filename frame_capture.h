@@ -0,0 +1,24 @@
+#ifndef FRAME_CAPTURE_H
+#define FRAME_CAPTURE_H
+
+/* Saves rendered frames as PPM images without stalling the render loop.
+   captureFrame() only queues an asynchronous glReadPixels into one of
+   CAPTURE_BUFFERS pixel pack buffers and fences it; a frame is mapped and
+   written out once its fence has signaled, normally a couple of frames
+   later, or when its buffer is needed again. */
+
+const int CAPTURE_BUFFERS = 3;
+
+/* Frames go to dir/frame_NNNNN.ppm; dir is created if needed */
+bool initFrameCapture (int width, int height, const char* dir);
+
+/* Queue the read framebuffer's current contents as frame number 'frame' */
+void captureFrame (int frame);
+/* Same, saved as dir/name.ppm */
+void captureFrameAs (const char* name);
+
+/* Write out every frame still in flight and free the buffers. Returns the
+   number of frames written since initFrameCapture(). */
+int finishFrameCapture ();
+
+#endif
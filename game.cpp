@@ -0,0 +1,602 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <stdlib.h>
+#include "game.h"
+#include "spatial_hash.h"
+#include "block_kernel.h"
+#include "jobs.h"
+
+/**************************
+* Game state             *
+**************************/
+
+float gun2_rot_dir_pos = 1;
+float gun2_rot_dir_neg = -1;
+float increments = 6;
+
+float rectangle_rotation = 0;
+float increase = 0.003;
+float decrease = -0.003;
+float speed = 0.01;
+int spc=0;
+int points=0;
+int flag=0;
+LaserBeam laser_beam;
+bool game_over=false;
+unsigned int game_tick=0;
+BlockPool block_pool;
+void (*block_removed) (int id, int cause) = NULL;
+
+World world;
+Entity green_basket = NO_ENTITY, red_basket = NO_ENTITY, gun = NO_ENTITY;
+Entity mirrors[2] = { NO_ENTITY, NO_ENTITY };
+
+/* Private random generator (xorshift32) so a seed fully determines a game */
+static unsigned int rng_state=1;
+
+static int block_count=DEFAULT_BLOCK_COUNT;
+
+/* A wave drops each kind in 6 columns 0.8 apart, starting at x=block_lane;
+   blocks beyond the first 6 of a kind stack in bands 10 units higher */
+const int BLOCK_COLUMNS = 6;
+const float BLOCK_SPACING = 0.8;
+const float BLOCK_BAND = 10;
+static const float block_lane[BLOCK_KINDS] = { -0.75, -0.5, -1 };
+/* Spawn height */
+const float BLOCK_TOP = 4.2;
+
+/* Shots end this far from the center, just off screen */
+const float LASER_RANGE = 4.5;
+
+/* Broadphase grid over the centers of the blocks on screen, the only ones
+   that can be caught. Collision tests compare centers, so queries only need
+   a little slop for rounding, not the block extents. */
+const float GRID_CELL = 1.0;
+const float GRID_SLOP = 0.01;
+static SpatialHash block_grid;
+static std::vector<uint64_t> in_grid;   // visible mask the grid was last synced to
+static std::vector<int> candidates;
+static std::vector<BlockCatch> catches;
+static std::vector<int> laser_candidates;
+static std::vector<int> collectors;   // archetypes of the baskets
+
+/* Drop a fresh wave of one kind above the screen */
+static void spawnWave (int kind)
+{
+  BlockPool& b = block_pool;
+  int i;
+  for (i=b.kind_start[kind];i<b.kind_start[kind+1];i++)
+  {
+    int j = i - b.kind_start[kind];
+    b.x[i] = block_lane[kind] + BLOCK_SPACING*(j % BLOCK_COLUMNS);
+    b.y[i] = BLOCK_TOP + gameRand() % 10 + BLOCK_BAND*(j / BLOCK_COLUMNS);
+    b.prev_y[i] = b.y[i];
+    b.vy[i] = -1;
+    b.alive[i] = 1;
+  }
+}
+
+/* Blocks per integration job: a multiple of 64, so no two jobs write the
+   same mask word */
+const int BLOCKS_PER_JOB = 16384;
+
+static void integrateJob (void* data, int begin, int end)
+{
+  float step = *(const float*)data;
+  BlockPool& b = block_pool;
+  std::copy(b.y.begin() + begin, b.y.begin() + end, b.prev_y.begin() + begin);
+  integrateBlocks(&b.y[begin], &b.vy[begin], &b.alive[begin], end - begin, step,
+                  BLOCK_BOTTOM, BLOCK_VISIBLE_TOP, &b.in_play[begin/64], &b.visible[begin/64]);
+}
+
+/* Move every block one tick, remembering where it was in prev_y, and
+   refresh the in_play/visible masks */
+static void integrate (float step)
+{
+  parallelFor(block_pool.count, BLOCKS_PER_JOB, integrateJob, &step);
+}
+
+/* Bring the grid in line with the visible mask: drop blocks that left the
+   screen or died, move (or add) the ones on it */
+static void syncBlockGrid ()
+{
+  const BlockPool& b = block_pool;
+  size_t w;
+  for (w=0;w<b.visible.size();w++)
+  {
+    uint64_t bits;
+    for (bits=in_grid[w] & ~b.visible[w];bits;bits&=bits-1)
+    removeObject(block_grid, w*64 + __builtin_ctzll(bits));
+    for (bits=b.visible[w];bits;bits&=bits-1)
+    {
+      int id = w*64 + __builtin_ctzll(bits);
+      moveObject(block_grid, id, b.x[id], b.y[id]);
+    }
+    in_grid[w] = b.visible[w];
+  }
+}
+
+/* Whether any bit in [begin, end) of the mask is set */
+static bool anyBit (const std::vector<uint64_t>& mask, int begin, int end)
+{
+  if (begin >= end)
+  return false;
+  int first = begin >> 6, last = (end-1) >> 6;
+  uint64_t head = ~(uint64_t)0 << (begin & 63);
+  uint64_t tail = ~(uint64_t)0 >> (63 - ((end-1) & 63));
+  if (first == last)
+  return (mask[first] & head & tail) != 0;
+  if (mask[first] & head)
+  return true;
+  int w;
+  for (w=first+1;w<last;w++)
+  if (mask[w])
+  return true;
+  return (mask[last] & tail) != 0;
+}
+
+/* Take a caught or shot block out of play until its kind respawns */
+static void killBlock (int id, int cause)
+{
+  block_pool.alive[id] = 0;
+  removeObject(block_grid, id);
+  if (block_removed)
+  block_removed(id, cause);
+}
+
+void initGameWorld ()
+{
+  if (gun != NO_ENTITY)
+  return;
+  // Green first: where the baskets overlap the red one is drawn on top
+  green_basket = createEntity(world, HAS_TRANSFORM | HAS_COLLIDER | HAS_SCORING);
+  red_basket = createEntity(world, HAS_TRANSFORM | HAS_COLLIDER | HAS_SCORING);
+  Entity baskets[2] = { green_basket, red_basket };
+  int kinds[2] = { BLOCK_GREEN, BLOCK_RED };
+  int i;
+  for (i=0;i<2;i++)
+  {
+    Collider* c = (Collider*)getComponent(world, baskets[i], COMPONENT_COLLIDER);
+    c->half_width = BASKET_HALF_WIDTH;
+    c->half_height = BASKET_HALF_HEIGHT;
+    ((Scoring*)getComponent(world, baskets[i], COMPONENT_SCORING))->kind = kinds[i];
+  }
+  gun = createEntity(world, HAS_TRANSFORM);
+
+  static const float mirror_x[2] = { MIRROR1_X, MIRROR2_X };
+  static const float mirror_y[2] = { MIRROR1_Y, MIRROR2_Y };
+  static const float mirror_rotation[2] = { 0, 90 };
+  for (i=0;i<2;i++)
+  {
+    mirrors[i] = createEntity(world, HAS_TRANSFORM | HAS_COLLIDER);
+    Transform& t = transformOf(mirrors[i]);
+    t.x = mirror_x[i];
+    t.y = mirror_y[i];
+    t.rotation = mirror_rotation[i];
+    Collider* c = (Collider*)getComponent(world, mirrors[i], COMPONENT_COLLIDER);
+    c->half_width = MIRROR_HALF_LENGTH;
+    c->half_height = 0.1;
+  }
+}
+
+void GameOver()
+{
+  game_over=true;
+}
+
+void setBlockCount (int count)
+{
+  block_count = count < BLOCK_KINDS ? BLOCK_KINDS : count;
+}
+
+int blockCount ()
+{
+  return block_count;
+}
+
+int gameRand ()
+{
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+  return rng_state & 0x7fffffff;
+}
+
+void resetGame (unsigned int seed)
+{
+  rng_state = seed ? seed : 0x9e3779b9;  // xorshift must not start at zero
+  game_tick = 0;
+  gun2_rot_dir_pos = 1;
+  initGameWorld();
+  transformOf(green_basket).x = 1.4;
+  transformOf(green_basket).y = BASKET_Y;
+  transformOf(red_basket).x = -1.4;
+  transformOf(red_basket).y = BASKET_Y;
+  transformOf(gun).x = GUN_X;
+  transformOf(gun).y = -0.3;
+  transformOf(gun).rotation = 0;
+  speed = 0.01;
+  spc=0;
+  points=0;
+  flag=0;
+  laser_beam.vertices=0;
+  laser_beam.ticks_left=0;
+  game_over=false;
+
+  BlockPool& b = block_pool;
+  if (b.count != block_count || block_grid.buckets.empty())
+  {
+    b.count = block_count;
+    b.x.assign(b.count, 0);
+    b.y.assign(b.count, 0);
+    b.vy.assign(b.count, 0);
+    b.prev_y.assign(b.count, 0);
+    b.kind.assign(b.count, 0);
+    b.alive.assign(b.count, 0);
+    b.in_play.assign((b.count+63)/64, 0);
+    b.visible.assign((b.count+63)/64, 0);
+    int kind, i;
+    for (kind=0;kind<=BLOCK_KINDS;kind++)
+    b.kind_start[kind] = (long long)kind*b.count/BLOCK_KINDS;
+    for (kind=0;kind<BLOCK_KINDS;kind++)
+    for (i=b.kind_start[kind];i<b.kind_start[kind+1];i++)
+    b.kind[i] = kind;
+    initSpatialHash(block_grid, GRID_CELL, 256, b.count);
+    in_grid.assign(b.visible.size(), 0);
+  }
+  clearSpatialHash(block_grid);
+  std::fill(in_grid.begin(), in_grid.end(), 0);
+  int kind;
+  for (kind=0;kind<BLOCK_KINDS;kind++)
+  spawnWave(kind);
+  integrate(0);   // a zero step only classifies the new blocks
+  syncBlockGrid();
+}
+
+void gameAction (int action)
+{
+  Transform& red = transformOf(red_basket);
+  Transform& green = transformOf(green_basket);
+  Transform& barrel = transformOf(gun);
+  switch (action) {
+    case ACTION_RED_BASKET_LEFT:
+    if (red.x>=-2.2)
+    red.x -= 0.2;
+    break;
+    case ACTION_RED_BASKET_RIGHT:
+    if (red.x<=3.4)
+    red.x += 0.2;
+    break;
+    case ACTION_GREEN_BASKET_LEFT:
+    if (green.x>=-2.2)
+    green.x -= 0.2;
+    break;
+    case ACTION_GREEN_BASKET_RIGHT:
+    if (green.x<=3.4)
+    green.x += 0.2;
+    break;
+    case ACTION_GUN_UP:
+    if (barrel.y<=2.5)
+    barrel.y += 0.2;
+    break;
+    case ACTION_GUN_DOWN:
+    if (barrel.y>=-1.4)
+    barrel.y -= 0.2;
+    break;
+    case ACTION_GUN_TILT_UP:
+    if (barrel.rotation <= 55)
+    barrel.rotation = barrel.rotation + increments*gun2_rot_dir_pos;
+    break;
+    case ACTION_GUN_TILT_DOWN:
+    if (barrel.rotation >= -55)
+    barrel.rotation = barrel.rotation + increments*gun2_rot_dir_neg;
+    break;
+    case ACTION_FLIP_TILT:
+    gun2_rot_dir_pos *= -1;
+    break;
+    case ACTION_SLOWER:
+    if (speed>0.004)
+    speed = speed + decrease;
+    break;
+    case ACTION_FASTER:
+    if(speed<3)
+    speed = speed + increase;
+    break;
+    case ACTION_FIRE:
+    spc=1;
+    break;
+    default:
+    break;
+  }
+}
+
+/* Distance along the ray (ox,oy)+t*(dx,dy) to the segment centered on
+   (cx,cy) with direction (ux,uy) and half-length h, or -1 if it misses */
+static float raySegment (float ox, float oy, float dx, float dy, float cx, float cy, float ux, float uy, float h)
+{
+  float denom = dx*uy - dy*ux;
+  if (fabsf(denom) < 1e-6f)
+  return -1;   // parallel
+  float wx = cx-ox, wy = cy-oy;
+  float t = (wx*uy - wy*ux)/denom;
+  float s = (wx*dy - wy*dx)/denom;
+  if (t <= 1e-4f || fabsf(s) > h)
+  return -1;
+  return t;
+}
+
+/* Distance along the ray to the box centered on (cx,cy) with half extents
+   (hx,hy), or -1 if it misses (slab test) */
+static float rayBox (float ox, float oy, float dx, float dy, float cx, float cy, float hx, float hy)
+{
+  float t_min = 0, t_max = 1e30f;
+  float o[2] = { ox, oy }, d[2] = { dx, dy }, c[2] = { cx, cy }, e[2] = { hx, hy };
+  int a;
+  for (a=0;a<2;a++)
+  {
+    if (fabsf(d[a]) < 1e-9f)
+    {
+      if (o[a] < c[a]-e[a] || o[a] > c[a]+e[a])
+      return -1;
+      continue;
+    }
+    float t0 = (c[a]-e[a]-o[a])/d[a];
+    float t1 = (c[a]+e[a]-o[a])/d[a];
+    if (t0 > t1)
+    std::swap(t0, t1);
+    t_min = fmaxf(t_min, t0);
+    t_max = fminf(t_max, t1);
+    if (t_min > t_max)
+    return -1;
+  }
+  return t_min;
+}
+
+/* Distance along the ray to the edge of the play area */
+static float rayExit (float ox, float oy, float dx, float dy)
+{
+  float t = 1e30f;
+  if (dx > 0) t = fminf(t, (LASER_RANGE-ox)/dx);
+  if (dx < 0) t = fminf(t, (-LASER_RANGE-ox)/dx);
+  if (dy > 0) t = fminf(t, (LASER_RANGE-oy)/dy);
+  if (dy < 0) t = fminf(t, (-LASER_RANGE-oy)/dy);
+  return fmaxf(t, 0);
+}
+
+/* Append the blocks in the grid whose box may touch the segment from
+   (ox,oy) to t_end along (dx,dy). Walks the cells the segment crosses
+   (DDA) and queries the piece of it inside each one, padded by the block
+   extents since the grid holds centers only. */
+static void querySegment (float ox, float oy, float dx, float dy, float t_end, std::vector<int>& out)
+{
+  const float pad_x = BLOCK_HALF_WIDTH + GRID_SLOP, pad_y = BLOCK_HALF_HEIGHT + GRID_SLOP;
+  float cell = block_grid.cell_size;
+  int cx = spatialCell(block_grid, ox), cy = spatialCell(block_grid, oy);
+  int steps = abs(spatialCell(block_grid, ox + t_end*dx) - cx) + abs(spatialCell(block_grid, oy + t_end*dy) - cy);
+  // Distance along the ray to the next vertical / horizontal cell border,
+  // and between two of them
+  float next_x = dx > 0 ? ((cx+1)*cell - ox)/dx : dx < 0 ? (cx*cell - ox)/dx : 1e30f;
+  float next_y = dy > 0 ? ((cy+1)*cell - oy)/dy : dy < 0 ? (cy*cell - oy)/dy : 1e30f;
+  float step_x = dx != 0 ? cell/fabsf(dx) : 1e30f;
+  float step_y = dy != 0 ? cell/fabsf(dy) : 1e30f;
+  float t = 0;
+  int k;
+  for (k=0;k<=steps;k++)
+  {
+    // The last piece runs to the end, whatever rounding did to the walk
+    float t_next = k == steps ? t_end : fminf(fminf(next_x, next_y), t_end);
+    float x0 = ox + t*dx, x1 = ox + t_next*dx;
+    float y0 = oy + t*dy, y1 = oy + t_next*dy;
+    queryRect(block_grid, fminf(x0, x1) - pad_x, fminf(y0, y1) - pad_y,
+              fmaxf(x0, x1) + pad_x, fmaxf(y0, y1) + pad_y, out);
+    if (next_x < next_y)
+    next_x += step_x;
+    else
+    next_y += step_y;
+    t = t_next;
+  }
+}
+
+int traceLaser (LaserBeam& beam)
+{
+  const Transform* mirror[2] = { &transformOf(mirrors[0]), &transformOf(mirrors[1]) };
+  float half_length[2];
+  int m;
+  for (m=0;m<2;m++)
+  half_length[m] = ((Collider*)getComponent(world, mirrors[m], COMPONENT_COLLIDER))->half_width;
+
+  const Transform& barrel = transformOf(gun);
+  float angle = barrel.rotation*M_PI/180.0f;
+  float dx = cosf(angle), dy = sinf(angle);
+  float ox = barrel.x + GUN_LENGTH*dx, oy = barrel.y + GUN_LENGTH*dy;
+  beam.x[0] = ox;
+  beam.y[0] = oy;
+  beam.vertices = 1;
+
+  int last_mirror = -1;
+  int bounce;
+  for (bounce=0;bounce<=LASER_MAX_BOUNCES;bounce++)
+  {
+    float t_end = rayExit(ox, oy, dx, dy);
+    int hit_mirror = -1, hit_block = -1;
+    for (m=0;m<2;m++)
+    {
+      if (m == last_mirror)
+      continue;
+      float a = mirror[m]->rotation*M_PI/180.0f;
+      float t = raySegment(ox, oy, dx, dy, mirror[m]->x, mirror[m]->y, cosf(a), sinf(a), half_length[m]);
+      if (t >= 0 && t < t_end)
+      {
+        t_end = t;
+        hit_mirror = m;
+      }
+    }
+    // Only blocks on screen are in the grid, and only those can be shot.
+    // Nearest hit first, ties to the lowest id.
+    laser_candidates.clear();
+    querySegment(ox, oy, dx, dy, t_end, laser_candidates);
+    std::sort(laser_candidates.begin(), laser_candidates.end());
+    size_t c;
+    for (c=0;c<laser_candidates.size();c++)
+    {
+      int id = laser_candidates[c];
+      if (!block_pool.alive[id] || (c > 0 && id == laser_candidates[c-1]))
+      continue;
+      float t = rayBox(ox, oy, dx, dy, block_pool.x[id], block_pool.y[id], BLOCK_HALF_WIDTH, BLOCK_HALF_HEIGHT);
+      if (t >= 0 && t < t_end)
+      {
+        t_end = t;
+        hit_block = id;
+        hit_mirror = -1;
+      }
+    }
+
+    ox += t_end*dx;
+    oy += t_end*dy;
+    beam.x[beam.vertices] = ox;
+    beam.y[beam.vertices] = oy;
+    beam.vertices++;
+
+    if (hit_block >= 0)
+    return hit_block;
+    if (hit_mirror < 0)
+    return -1;   // left the play area
+
+    // Reflect about the mirror's normal
+    float a = mirror[hit_mirror]->rotation*M_PI/180.0f;
+    float nx = -sinf(a), ny = cosf(a);
+    float dn = dx*nx + dy*ny;
+    dx -= 2*dn*nx;
+    dy -= 2*dn*ny;
+    last_mirror = hit_mirror;
+  }
+  return -1;
+}
+
+/* Fire the gun: trace the shot against the blocks as they are this tick and
+   score the block it stops at */
+static void castLaser ()
+{
+  int hit = traceLaser(laser_beam);
+  laser_beam.ticks_left = LASER_BEAM_TICKS;
+  if (hit >= 0)
+  {
+    // Shooting a black block is good, red or green ones cost points
+    flag = block_pool.kind[hit]==BLOCK_BLACK ? 2 : 1;
+    killBlock(hit, REMOVED_SHOT);
+  }
+}
+
+void catchCandidates (std::vector<int>& out)
+{
+  // Only blocks in the cells around a basket can be caught
+  out.clear();
+  findArchetypes(world, HAS_TRANSFORM | HAS_COLLIDER | HAS_SCORING, collectors);
+  size_t a;
+  int i;
+  for (a=0;a<collectors.size();a++)
+  {
+    Archetype& arch = world.archetypes[collectors[a]];
+    const Transform* t = (const Transform*)column(arch, COMPONENT_TRANSFORM);
+    const Collider* box = (const Collider*)column(arch, COMPONENT_COLLIDER);
+    for (i=0;i<arch.count;i++)
+    queryRect(block_grid, t[i].x-box[i].half_width-GRID_SLOP, CATCH_BOTTOM-GRID_SLOP,
+              t[i].x+box[i].half_width+GRID_SLOP, CATCH_TOP+GRID_SLOP, out);
+  }
+  // Resolve in id order so the outcome does not depend on the hash layout
+  std::sort(out.begin(), out.end());
+  out.erase(std::unique(out.begin(), out.end()), out.end());
+}
+
+void findCatches (const std::vector<int>& candidates, std::vector<BlockCatch>& caught)
+{
+  const BlockPool& b = block_pool;
+  findArchetypes(world, HAS_TRANSFORM | HAS_COLLIDER | HAS_SCORING, collectors);
+  size_t a, c;
+  int i;
+  for (c=0;c<candidates.size();c++)
+  {
+    int id=candidates[c];
+    float xpos=b.x[id], ypos=b.y[id];
+    if (!b.alive[id] || ypos>=CATCH_TOP || ypos<=CATCH_BOTTOM)
+    continue;
+    // A block scores in a basket of its kind; black ones cost points in any
+    int kind=b.kind[id];
+    bool in_basket=false, scores=false;
+    for (a=0;a<collectors.size();a++)
+    {
+      Archetype& arch = world.archetypes[collectors[a]];
+      const Transform* t = (const Transform*)column(arch, COMPONENT_TRANSFORM);
+      const Collider* box = (const Collider*)column(arch, COMPONENT_COLLIDER);
+      const Scoring* score = (const Scoring*)column(arch, COMPONENT_SCORING);
+      for (i=0;i<arch.count;i++)
+      if (xpos>t[i].x-box[i].half_width && xpos<t[i].x+box[i].half_width)
+      {
+        in_basket=true;
+        scores=scores || score[i].kind==kind;
+      }
+    }
+    if (scores || (kind==BLOCK_BLACK && in_basket))
+    {
+      BlockCatch caught_block = { id, scores ? 2 : 1 };
+      caught.push_back(caught_block);
+    }
+  }
+}
+
+/* Advance the game by one fixed tick: movement, collisions and scoring */
+void update ()
+{
+  game_tick++;
+
+  BlockPool& b = block_pool;
+  int kind;
+
+  // A kind respawns as a whole once all of its blocks are gone or below the
+  // screen; decided on this tick's positions, before anything is caught
+  bool wave_over[BLOCK_KINDS];
+  for (kind=0;kind<BLOCK_KINDS;kind++)
+  wave_over[kind] = !anyBit(b.in_play, b.kind_start[kind], b.kind_start[kind+1]);
+
+  // The shot is resolved instantly against this tick's block positions
+  if (laser_beam.ticks_left>0)
+  laser_beam.ticks_left--;
+  if (spc==1 && laser_beam.ticks_left==0)
+  castLaser();
+  spc=0;
+
+  // In id order, the last catch sets the flag
+  catchCandidates(candidates);
+  catches.clear();
+  findCatches(candidates, catches);
+  size_t c;
+  for (c=0;c<catches.size();c++)
+  {
+    flag=catches[c].flag;
+    killBlock(catches[c].id, REMOVED_CAUGHT);
+  }
+
+  for (kind=0;kind<BLOCK_KINDS;kind++)
+  if (wave_over[kind])
+  spawnWave(kind);
+
+  // One SIMD pass over every block, split across the job threads; dead
+  // ones keep falling out of sight, which is cheaper than branching on them
+  integrate(speed);
+  syncBlockGrid();
+  runSystems(world, PHASE_TICK, TICK_DT);
+
+  if(flag==1)
+  {
+    points-=5;
+    flag=0;
+  }
+  if (flag==2)
+  {
+    points+=10;
+    flag=0;
+  }
+  if (points<-40)
+  GameOver();
+}
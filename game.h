@@ -0,0 +1,180 @@
+#ifndef GAME_H
+#define GAME_H
+
+/* Game state and simulation, kept free of any GL/GLFW dependency so the
+   same logic runs in the windowed game and in the headless simulator */
+
+#include <vector>
+#include <stdint.h>
+#include "ecs.h"
+
+/* Simulation runs at a fixed rate, independent of the display refresh rate */
+const double TICK_RATE = 60.0;
+const double TICK_DT = 1.0/TICK_RATE;
+
+/* The gun barrel starts at the gun's position, (GUN_X, y), and is
+   GUN_LENGTH long */
+const float GUN_X = -3.5;
+const float GUN_LENGTH = 0.8;
+
+/* Mirrors are double-sided segments of half-length MIRROR_HALF_LENGTH,
+   centered on their position and rotated by their transform */
+const float MIRROR1_X = 0, MIRROR1_Y = 3;
+const float MIRROR2_X = 3.2, MIRROR2_Y = 0.5;
+const float MIRROR_HALF_LENGTH = 0.45;
+
+/* Baskets slide along y = BASKET_Y and catch blocks whose center passes
+   within BASKET_HALF_WIDTH of theirs */
+const float BASKET_Y = -3.67;
+const double BASKET_HALF_WIDTH = 0.45, BASKET_HALF_HEIGHT = 0.35;
+/* Blocks are caught while their center is between these heights */
+const double CATCH_TOP = -3.32, CATCH_BOTTOM = -3.34;
+
+/* A shot is a ray cast once, when fired: it reflects off the mirrors up to
+   LASER_MAX_BOUNCES times and stops at the first block it meets or when it
+   leaves the play area. The beam is then shown for LASER_BEAM_TICKS. */
+const int LASER_MAX_BOUNCES = 4;
+const int LASER_BEAM_TICKS = 8;
+
+struct LaserBeam {
+  float x[LASER_MAX_BOUNCES+2], y[LASER_MAX_BOUNCES+2];  // polyline from the gun
+  int vertices;
+  int ticks_left;   // 0 when no beam is showing; the gun can fire again
+};
+typedef struct LaserBeam LaserBeam;
+
+/* Falling blocks, stored as parallel arrays (structure of arrays) so the
+   per-tick loops stream through memory and vectorize. Blocks of one kind
+   are contiguous: kind k owns ids [kind_start[k], kind_start[k+1]). */
+enum BlockKind {
+  BLOCK_RED,     // caught in the red basket
+  BLOCK_GREEN,   // caught in the green basket
+  BLOCK_BLACK,   // to be shot, costs points when caught
+  BLOCK_KINDS
+};
+
+const int DEFAULT_BLOCK_COUNT = 18;
+
+/* Half size of a block, matching its quad in the renderer */
+const float BLOCK_HALF_WIDTH = 0.05;
+const float BLOCK_HALF_HEIGHT = 0.15;
+/* The line below which a block has left the screen */
+const float BLOCK_BOTTOM = -4.2;
+/* Centers above this can't be seen, the screen ends at y=4 */
+const float BLOCK_VISIBLE_TOP = 4 + BLOCK_HALF_HEIGHT;
+
+struct BlockPool {
+  int count;
+  int kind_start[BLOCK_KINDS+1];
+  std::vector<float> x, y;
+  std::vector<float> vy;              // velocity in units of the game speed, -1 falls at 'speed'
+  std::vector<float> prev_y;          // y at the start of the last tick, to interpolate the render
+  std::vector<unsigned char> kind;    // BlockKind
+  std::vector<unsigned char> alive;   // cleared when caught or shot, until the kind respawns
+  /* Bitmasks, bit i for block i, refreshed by every tick's integration:
+     in_play is alive and not yet below the screen, visible is in_play and
+     not above it either */
+  std::vector<uint64_t> in_play, visible;
+};
+typedef struct BlockPool BlockPool;
+
+/* A block the baskets catch, and what it does to the score through 'flag':
+   2 (+10) in a basket of its kind, 1 (-5) for a black block in any basket */
+struct BlockCatch {
+  int id;
+  int flag;
+};
+typedef struct BlockCatch BlockCatch;
+
+/* Why a block was taken out of play, see block_removed */
+enum BlockRemoval {
+  REMOVED_SHOT,     // hit by the laser
+  REMOVED_CAUGHT    // landed in a basket
+};
+
+/* Player actions, produced by the keyboard/mouse callbacks or a bot */
+enum GameAction {
+  ACTION_RED_BASKET_LEFT,
+  ACTION_RED_BASKET_RIGHT,
+  ACTION_GREEN_BASKET_LEFT,
+  ACTION_GREEN_BASKET_RIGHT,
+  ACTION_GUN_UP,
+  ACTION_GUN_DOWN,
+  ACTION_GUN_TILT_UP,
+  ACTION_GUN_TILT_DOWN,
+  ACTION_FLIP_TILT,
+  ACTION_SLOWER,
+  ACTION_FASTER,
+  ACTION_FIRE
+};
+
+extern float gun2_rot_dir_pos;
+extern float gun2_rot_dir_neg;
+extern float increments;
+
+extern float rectangle_rotation;
+extern float increase;
+extern float decrease;
+extern float speed;
+extern int spc;   // fire requested, the shot is cast on the next tick
+extern int points;
+extern int flag;
+extern LaserBeam laser_beam;
+extern bool game_over;
+extern unsigned int game_tick;   // ticks simulated since resetGame()
+extern BlockPool block_pool;
+
+/* Every game object but the blocks is an entity of 'world': the baskets
+   (Transform, Collider, Scoring), the gun (Transform: the barrel's pivot and
+   tilt) and the mirrors (Transform, Collider). They exist from the first
+   resetGame() or initGameWorld() on. The renderer adds its own components
+   and entities to the same world. */
+extern World world;
+extern Entity green_basket, red_basket, gun, mirrors[2];
+
+void initGameWorld ();
+
+/* Transform of a game entity */
+inline Transform& transformOf (Entity entity)
+{
+  return *(Transform*)getComponent(world, entity, COMPONENT_TRANSFORM);
+}
+
+/* Called by update() whenever a block is shot or caught, with the block
+   still at the position it was removed from. For effects only: it must not
+   change the game state. NULL (nothing called) by default. */
+extern void (*block_removed) (int id, int cause);
+
+/* Put every object back in its starting place and drop new blocks.
+   All randomness comes from gameRand(), so the seed and the sequence of
+   actions fully determine a game. */
+void resetGame (unsigned int seed);
+
+/* Number of blocks, split evenly between the kinds, from the next
+   resetGame() on. At least one block of each kind. */
+void setBlockCount (int count);
+int blockCount ();
+
+/* Next value of the game's random sequence, in [0, 2^31) */
+int gameRand ();
+
+/* Apply one player action to the game state */
+void gameAction (int action);
+
+/* Trace a shot from the gun as it is aimed now into 'beam' (ticks_left is
+   left alone), bouncing off the mirrors. Returns the id of the block it
+   stops at, or -1. Changes no game state; update() fires through it. */
+int traceLaser (LaserBeam& beam);
+
+/* The basket test of update(), in two steps that change no state. The
+   broadphase sets 'candidates' to the blocks in the grid cells around the
+   baskets' catch band, in increasing id order; findCatches() appends to
+   'caught' those of the candidates (any ids, in increasing order) the
+   baskets catch this tick. */
+void catchCandidates (std::vector<int>& candidates);
+void findCatches (const std::vector<int>& candidates, std::vector<BlockCatch>& caught);
+
+/* Advance the game by one fixed tick: movement, collisions and scoring */
+void update ();
+
+#endif
@@ -0,0 +1,231 @@
+#include <vector>
+#include <stddef.h>
+#include "gl_state.h"
+using namespace std;
+
+/* Stands for a binding not known, never a name GL hands out */
+const GLuint UNKNOWN = ~0u;
+
+const GLenum CACHED_TARGETS[] = { GL_ARRAY_BUFFER, GL_UNIFORM_BUFFER, GL_COPY_WRITE_BUFFER };
+const int BUFFER_TARGETS = sizeof(CACHED_TARGETS)/sizeof(CACHED_TARGETS[0]);
+/* GL 3.3 has at least 36 uniform buffer bindings, the renderer uses two */
+const GLuint UNIFORM_BINDINGS = 16;
+/* Attribute indices tracked per vertex array, one bit each */
+const GLuint CACHED_ATTRIBS = 32;
+
+struct IndexedBinding {
+  GLuint buffer;
+  GLintptr offset;
+  GLsizeiptr size;   // -1 for the whole buffer (glBindBufferBase)
+};
+typedef struct IndexedBinding IndexedBinding;
+
+struct AttribState {
+  unsigned known;     // attributes set through here since the array was created
+  unsigned enabled;
+};
+typedef struct AttribState AttribState;
+
+static GLuint program = UNKNOWN;
+static GLuint vertex_array = UNKNOWN;
+static GLuint buffers[BUFFER_TARGETS];
+static IndexedBinding uniform_bindings[UNIFORM_BINDINGS];
+static GLenum polygon_mode = 0;   // 0 when not known
+static int depth_test = -1;       // -1 when not known
+static GLenum depth_func = 0;
+static vector<AttribState> attribs;   // by vertex array name
+static GLStateCounts counts;
+
+/* Count a call, which is needed when it would change the state */
+static bool needed (bool changes)
+{
+  if (changes)
+    counts.issued++;
+  else
+    counts.elided++;
+  return changes;
+}
+
+static int targetIndex (GLenum target)
+{
+  int i;
+  for (i=0;i<BUFFER_TARGETS;i++)
+    if (CACHED_TARGETS[i] == target)
+      return i;
+  return -1;
+}
+
+void resetGLState ()
+{
+  program = vertex_array = UNKNOWN;
+  int i;
+  for (i=0;i<BUFFER_TARGETS;i++)
+    buffers[i] = UNKNOWN;
+  GLuint index;
+  for (index=0;index<UNIFORM_BINDINGS;index++)
+    uniform_bindings[index].buffer = UNKNOWN;
+  polygon_mode = 0;
+  depth_test = -1;
+  depth_func = 0;
+  attribs.clear();
+}
+
+void useProgram (GLuint id)
+{
+  if (!needed(id != program))
+    return;
+  glUseProgram(id);
+  program = id;
+}
+
+void bindVertexArray (GLuint vao)
+{
+  if (!needed(vao != vertex_array))
+    return;
+  glBindVertexArray(vao);
+  vertex_array = vao;
+}
+
+void bindBuffer (GLenum target, GLuint buffer)
+{
+  int t = targetIndex(target);
+  if (!needed(t < 0 || buffers[t] != buffer))
+    return;
+  glBindBuffer(target, buffer);
+  if (t >= 0)
+    buffers[t] = buffer;
+}
+
+static void bindIndexed (GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+  bool cached = target == GL_UNIFORM_BUFFER && index < UNIFORM_BINDINGS;
+  if (cached) {
+    const IndexedBinding& bound = uniform_bindings[index];
+    if (!needed(bound.buffer != buffer || bound.offset != offset || bound.size != size))
+      return;
+  }
+  else
+    counts.issued++;
+  if (size < 0)
+    glBindBufferBase(target, index, buffer);
+  else
+    glBindBufferRange(target, index, buffer, offset, size);
+  if (cached) {
+    IndexedBinding& bound = uniform_bindings[index];
+    bound.buffer = buffer;
+    bound.offset = offset;
+    bound.size = size;
+  }
+  int t = targetIndex(target);
+  if (t >= 0)
+    buffers[t] = buffer;
+}
+
+void bindBufferBase (GLenum target, GLuint index, GLuint buffer)
+{
+  bindIndexed(target, index, buffer, 0, -1);
+}
+
+void bindBufferRange (GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+  bindIndexed(target, index, buffer, offset, size);
+}
+
+void setPolygonMode (GLenum mode)
+{
+  if (!needed(mode != polygon_mode))
+    return;
+  glPolygonMode(GL_FRONT_AND_BACK, mode);
+  polygon_mode = mode;
+}
+
+void setDepthTest (bool enabled)
+{
+  if (!needed(depth_test != (int)enabled))
+    return;
+  if (enabled)
+    glEnable(GL_DEPTH_TEST);
+  else
+    glDisable(GL_DEPTH_TEST);
+  depth_test = enabled;
+}
+
+void setDepthFunc (GLenum func)
+{
+  if (!needed(func != depth_func))
+    return;
+  glDepthFunc(func);
+  depth_func = func;
+}
+
+/* Cached attributes of the bound vertex array, NULL if not tracked */
+static AttribState* boundAttribs (GLuint index)
+{
+  if (vertex_array == UNKNOWN || index >= CACHED_ATTRIBS)
+    return NULL;
+  if (vertex_array >= attribs.size()) {
+    AttribState none = { 0, 0 };
+    attribs.resize(vertex_array + 1, none);
+  }
+  return &attribs[vertex_array];
+}
+
+static void setVertexAttrib (GLuint index, bool enabled)
+{
+  AttribState* state = boundAttribs(index);
+  unsigned bit = 1u << (index % CACHED_ATTRIBS);
+  if (!needed(!state || !(state->known & bit) || ((state->enabled & bit) != 0) != enabled))
+    return;
+  if (enabled)
+    glEnableVertexAttribArray(index);
+  else
+    glDisableVertexAttribArray(index);
+  if (!state)
+    return;
+  state->known |= bit;
+  if (enabled)
+    state->enabled |= bit;
+  else
+    state->enabled &= ~bit;
+}
+
+void enableVertexAttrib (GLuint index)
+{
+  setVertexAttrib(index, true);
+}
+
+void disableVertexAttrib (GLuint index)
+{
+  setVertexAttrib(index, false);
+}
+
+void forgetBuffer (GLuint buffer)
+{
+  if (buffer == 0)
+    return;
+  int i;
+  for (i=0;i<BUFFER_TARGETS;i++)
+    if (buffers[i] == buffer)
+      buffers[i] = UNKNOWN;
+  GLuint index;
+  for (index=0;index<UNIFORM_BINDINGS;index++)
+    if (uniform_bindings[index].buffer == buffer)
+      uniform_bindings[index].buffer = UNKNOWN;
+}
+
+void forgetVertexArray (GLuint vao)
+{
+  if (vao == 0)
+    return;
+  if (vertex_array == vao)
+    vertex_array = UNKNOWN;
+  if (vao < attribs.size())
+    attribs[vao].known = attribs[vao].enabled = 0;
+}
+
+GLStateCounts takeGLStateCounts ()
+{
+  GLStateCounts taken = counts;
+  counts.issued = counts.elided = 0;
+  return taken;
+}
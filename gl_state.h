@@ -0,0 +1,55 @@
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include <glad/glad.h>
+
+/* Shadow copy of the GL state the renderer changes most, so setting a value
+   that is already current costs no driver call. Covers the program, the
+   vertex array, the array / uniform / copy-write buffer bindings, the
+   indexed uniform buffer bindings, polygon mode, depth test and function,
+   and the enabled vertex attributes of each vertex array. Every call goes
+   through here or the copy is stale: state changed behind its back must be
+   changed back, or resetGLState() called.
+
+   Counts the calls issued and elided until takeGLStateCounts(), usually
+   once per frame. Like the context itself, use it from the thread that has
+   the context current only. */
+
+struct GLStateCounts {
+  int issued;
+  int elided;
+};
+typedef struct GLStateCounts GLStateCounts;
+
+/* Forget everything: the next call of each kind is always issued. Call once
+   a new context is current. */
+void resetGLState ();
+
+void useProgram (GLuint program);
+void bindVertexArray (GLuint vao);
+/* Targets other than GL_ARRAY_BUFFER, GL_UNIFORM_BUFFER and
+   GL_COPY_WRITE_BUFFER are passed through uncached */
+void bindBuffer (GLenum target, GLuint buffer);
+/* Uniform buffer bindings only. An issued call also sets the generic
+   binding, as in GL; an elided one leaves it alone, so use bindBuffer()
+   before relying on the generic binding. */
+void bindBufferBase (GLenum target, GLuint index, GLuint buffer);
+void bindBufferRange (GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+/* Front and back faces together */
+void setPolygonMode (GLenum mode);
+void setDepthTest (bool enabled);
+void setDepthFunc (GLenum func);
+/* On the vertex array currently bound with bindVertexArray() */
+void enableVertexAttrib (GLuint index);
+void disableVertexAttrib (GLuint index);
+
+/* Call right before glDeleteBuffers / glDeleteVertexArrays: GL unbinds the
+   deleted objects and may hand their names out again. A deleted program
+   stays in use until another one is, so programs need no such call. */
+void forgetBuffer (GLuint buffer);
+void forgetVertexArray (GLuint vao);
+
+/* Calls issued and elided since the last call */
+GLStateCounts takeGLStateCounts ();
+
+#endif
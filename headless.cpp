@@ -0,0 +1,222 @@
+#include <iostream>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "game.h"
+#include "replay.h"
+#include "block_kernel.h"
+#include "jobs.h"
+using namespace std;
+
+/* Headless simulator: runs the game logic from game.cpp with no window or
+   GL context, as fast as the CPU allows. Used for balancing and regression
+   runs on machines without a display. */
+
+/* How often (in ticks) the bot may press a key, roughly human speed */
+const int BOT_REACTION_TICKS = 6;
+
+/* Column of the lowest block of one kind that can still be caught, or 99 */
+float lowestBlockX (int kind)
+{
+  const BlockPool& b = block_pool;
+  float best_y = 99, best_x = 99;
+  int i;
+  for (i=b.kind_start[kind];i<b.kind_start[kind+1];i++)
+  {
+    float y = b.y[i];
+    if (b.alive[i] && y > -3.33 && y < 4 && y < best_y)
+    {
+      best_y = y;
+      best_x = b.x[i];
+    }
+  }
+  return best_x;
+}
+
+/* Apply a bot action, logging it when the game is being recorded */
+void botAction (int action)
+{
+  recordAction(game_tick, action);
+  gameAction(action);
+}
+
+/* Simple scripted player: chases blocks with the baskets and shoots black ones */
+void botPlay (int tick)
+{
+  if (tick % BOT_REACTION_TICKS != 0)
+    return;
+
+  float red_x = lowestBlockX(BLOCK_RED);
+  float red_basket_x = transformOf(red_basket).x;
+  if (red_x < 99 && red_x < red_basket_x-0.1)
+    botAction(ACTION_RED_BASKET_LEFT);
+  else if (red_x < 99 && red_x > red_basket_x+0.1)
+    botAction(ACTION_RED_BASKET_RIGHT);
+
+  float green_x = lowestBlockX(BLOCK_GREEN);
+  float green_basket_x = transformOf(green_basket).x;
+  if (green_x < 99 && green_x < green_basket_x-0.1)
+    botAction(ACTION_GREEN_BASKET_LEFT);
+  else if (green_x < 99 && green_x > green_basket_x+0.1)
+    botAction(ACTION_GREEN_BASKET_RIGHT);
+
+  // Line the gun up with the lowest black block and fire when level with it
+  if (laser_beam.ticks_left == 0)
+  {
+    const BlockPool& b = block_pool;
+    float target = 99;
+    int i;
+    for (i=b.kind_start[BLOCK_BLACK];i<b.kind_start[BLOCK_BLACK+1];i++)
+    {
+      float y = b.y[i];
+      if (b.alive[i] && y > -1.4 && y < 2.6 && y < target)
+        target = y;
+    }
+    if (target < 99)
+    {
+      float gun_y = transformOf(gun).y;
+      if (target > gun_y+0.1)
+        botAction(ACTION_GUN_UP);
+      else if (target < gun_y-0.1)
+        botAction(ACTION_GUN_DOWN);
+      else
+        botAction(ACTION_FIRE);
+    }
+  }
+}
+
+void usage (const char* name)
+{
+  fprintf(stderr, "usage: %s [--games N] [--ticks N] [--seed N] [--blocks N] [--kernel K] [--threads N] [--idle] [--verbose] [--record file]\n", name);
+  fprintf(stderr, "       %s --replay file [--repeat N] [--threads N]\n", name);
+  fprintf(stderr, "  --record f  save the first game to replay file f\n");
+  fprintf(stderr, "  --games N   number of games to simulate (default 1000)\n");
+  fprintf(stderr, "  --ticks N   tick limit per game, %g ticks per second (default 18000)\n", TICK_RATE);
+  fprintf(stderr, "  --seed N    seed of the first game, game i uses seed+i (default 1)\n");
+  fprintf(stderr, "  --blocks N  falling blocks per game, split between the colors (default %d)\n", DEFAULT_BLOCK_COUNT);
+  fprintf(stderr, "  --kernel K  block update kernel: scalar, sse2 or avx2 (default: best supported)\n");
+  fprintf(stderr, "  --threads N threads splitting each tick, 0 for one per core (default 0)\n");
+  fprintf(stderr, "  --idle      no player input, blocks just fall\n");
+  fprintf(stderr, "  --verbose   print the result of every game\n");
+  fprintf(stderr, "  --replay    replay a recorded game and check its final score\n");
+  fprintf(stderr, "  --repeat N  replay it N times to benchmark the same workload (default 1)\n");
+}
+
+/* Re-run a recorded game, compare with the recorded score and report speed */
+int runReplay (const char* path, int repeat)
+{
+  Replay replay;
+  if (!loadReplay(path, replay))
+    return 1;
+
+  int result = 0;
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  int i;
+  for (i=0;i<repeat;i++)
+    result = playReplay(replay);
+  double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+  printf("replay: seed %u, %d blocks, %zu actions, %u ticks, points %d\n", replay.seed, replay.blocks, replay.events.size(), game_tick, result);
+  printf("time: %.3fs for %d runs  ticks/s: %.0f\n", seconds, repeat, (double)game_tick*repeat/seconds);
+  if (!replay.complete) {
+    printf("recording has no end record, nothing to verify\n");
+    return 0;
+  }
+  if (result != replay.final_points) {
+    printf("MISMATCH: recorded points %d, replayed points %d\n", replay.final_points, result);
+    return 2;
+  }
+  printf("matches recorded points\n");
+  return 0;
+}
+
+int main (int argc, char** argv)
+{
+  int games = 1000;
+  int max_ticks = 18000;
+  unsigned int seed = 1;
+  bool idle = false, verbose = false;
+  const char* replay_path = NULL;
+  const char* record_path = NULL;
+  int repeat = 1;
+  int kernel = -1;
+  int threads = 0;
+
+  int i;
+  for (i=1;i<argc;i++)
+  {
+    if (!strcmp(argv[i], "--games") && i+1<argc)
+      games = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--ticks") && i+1<argc)
+      max_ticks = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--seed") && i+1<argc)
+      seed = strtoul(argv[++i], NULL, 10);
+    else if (!strcmp(argv[i], "--blocks") && i+1<argc)
+      setBlockCount(atoi(argv[++i]));
+    else if (!strcmp(argv[i], "--kernel") && i+1<argc && parseBlockKernel(argv[i+1]) >= 0)
+      kernel = parseBlockKernel(argv[++i]);
+    else if (!strcmp(argv[i], "--idle"))
+      idle = true;
+    else if (!strcmp(argv[i], "--verbose"))
+      verbose = true;
+    else if (!strcmp(argv[i], "--replay") && i+1<argc)
+      replay_path = argv[++i];
+    else if (!strcmp(argv[i], "--record") && i+1<argc)
+      record_path = argv[++i];
+    else if (!strcmp(argv[i], "--repeat") && i+1<argc)
+      repeat = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--threads") && i+1<argc)
+      threads = atoi(argv[++i]);
+    else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  int used = selectBlockKernel(kernel);
+  if (kernel >= 0 && used != kernel)
+    fprintf(stderr, "%s kernel not supported by this CPU, using %s\n", blockKernelName(kernel), blockKernelName(used));
+  threads = startJobs(threads > 0 ? threads - 1 : -1);
+
+  if (replay_path)
+    return runReplay(replay_path, repeat);
+
+  long long total_ticks = 0;
+  long long score_sum = 0;
+  int min_score = 0, max_score = 0, lost = 0;
+
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  int g;
+  for (g=0;g<games;g++)
+  {
+    resetGame(seed+g);
+    if (g == 0 && record_path && !startRecording(record_path, seed))
+      return 1;
+
+    int tick;
+    for (tick=0;tick<max_ticks && !game_over;tick++)
+    {
+      if (!idle)
+        botPlay(tick);
+      update();
+    }
+
+    stopRecording(game_tick, points);
+    total_ticks += tick;
+    score_sum += points;
+    if (g == 0 || points < min_score)
+      min_score = points;
+    if (g == 0 || points > max_score)
+      max_score = points;
+    if (game_over)
+      lost++;
+    if (verbose)
+      printf("game %d seed %u: points %d after %d ticks%s\n", g, seed+g, points, tick, game_over ? " (game over)" : "");
+  }
+  double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+  printf("games: %d  lost: %d  points min/mean/max: %d / %.2f / %d\n", games, lost, min_score, games ? (double)score_sum/games : 0.0, max_score);
+  printf("ticks: %lld  time: %.3fs  games/s: %.1f  ticks/s: %.0f  kernel: %s  threads: %d\n", total_ticks, seconds, games/seconds, total_ticks/seconds, blockKernelName(used), threads);
+  return 0;
+}
@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include "image_diff.h"
+
+/* Largest possible value of colorDistance(), reached by complementary
+   colors such as red against cyan (black against white is about 32857);
+   the constant pixelmatch uses */
+const float MAX_YIQ_DISTANCE = 35215;
+
+bool readPPM (const char* path, Image& image)
+{
+  FILE* f = fopen(path, "rb");
+  if (!f)
+    return false;
+  int maxval = 0;
+  // The single whitespace byte after maxval is consumed by the fgetc
+  bool ok = fscanf(f, "P6 %d %d %d", &image.width, &image.height, &maxval) == 3
+         && maxval == 255 && image.width > 0 && image.height > 0 && fgetc(f) != EOF;
+  if (ok) {
+    image.rgb.resize((size_t)image.width*image.height*3);
+    ok = fread(&image.rgb[0], 1, image.rgb.size(), f) == image.rgb.size();
+  }
+  fclose(f);
+  return ok;
+}
+
+bool writePPM (const char* path, const Image& image)
+{
+  FILE* f = fopen(path, "wb");
+  if (!f)
+    return false;
+  fprintf(f, "P6\n%d %d\n255\n", image.width, image.height);
+  bool ok = fwrite(&image.rgb[0], 1, image.rgb.size(), f) == image.rgb.size();
+  return fclose(f) == 0 && ok;
+}
+
+/* Squared YIQ distance with the weights of Kotsarenko and Ramos,
+   "Measuring perceived color difference using YIQ NTSC transmission color
+   space in mobile applications" (2010) */
+static float colorDistance (const unsigned char* p, const unsigned char* q)
+{
+  float r = p[0] - q[0], g = p[1] - q[1], b = p[2] - q[2];
+  float y = r*0.29889531f + g*0.58662247f + b*0.11448223f;
+  float i = r*0.59597799f - g*0.27417610f - b*0.32180189f;
+  float k = r*0.21147017f - g*0.52261711f + b*0.31114694f;
+  return 0.5053f*y*y + 0.299f*i*i + 0.1957f*k*k;
+}
+
+int compareImages (const Image& a, const Image& b, float threshold, Image* diff)
+{
+  if (a.width != b.width || a.height != b.height)
+    return -1;
+  if (diff) {
+    diff->width = a.width;
+    diff->height = a.height;
+    diff->rgb.resize(a.rgb.size());
+  }
+  // The distance is squared, so is the threshold
+  float limit = MAX_YIQ_DISTANCE * threshold * threshold;
+  int count = 0;
+  size_t i, n = (size_t)a.width*a.height;
+  for (i=0;i<n;i++) {
+    const unsigned char* p = &a.rgb[i*3];
+    bool differs = colorDistance(p, &b.rgb[i*3]) > limit;
+    count += differs;
+    if (!diff)
+      continue;
+    unsigned char* out = &diff->rgb[i*3];
+    if (differs) {
+      out[0] = 255;
+      out[1] = out[2] = 0;
+    }
+    else {
+      // Faded gray of the original for context
+      unsigned char gray = 192 + (p[0]*77 + p[1]*150 + p[2]*29) / 256 / 4;
+      out[0] = out[1] = out[2] = gray;
+    }
+  }
+  return count;
+}
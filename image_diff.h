@@ -0,0 +1,30 @@
+#ifndef IMAGE_DIFF_H
+#define IMAGE_DIFF_H
+
+#include <vector>
+
+/* RGB images as written by frame_capture, and a perceptual comparison for
+   golden-image checks. Two pixels differ when their distance in YIQ space,
+   weighted like the eye's sensitivity to brightness and to each color
+   axis, exceeds a threshold; small shading or rounding differences between
+   drivers stay under it while a wrong color or a missing object does not. */
+
+struct Image {
+  int width, height;
+  std::vector<unsigned char> rgb;   // rows top down, 3 bytes per pixel
+};
+typedef struct Image Image;
+
+/* Binary (P6) PPM with maxval 255 */
+bool readPPM (const char* path, Image& image);
+bool writePPM (const char* path, const Image& image);
+
+/* Default threshold, as a fraction of the largest possible YIQ distance */
+const float DIFF_THRESHOLD = 0.1;
+
+/* Number of pixels of a and b farther apart than 'threshold' (0-1), or -1
+   if the sizes differ. If 'diff' is given it receives a faded copy of 'a'
+   with the differing pixels in red. */
+int compareImages (const Image& a, const Image& b, float threshold, Image* diff);
+
+#endif
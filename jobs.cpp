@@ -0,0 +1,206 @@
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <stdlib.h>
+#include "jobs.h"
+using namespace std;
+
+struct JobThread {
+  mutex lock;          // guards 'queue'; thieves take it too
+  deque<Job*> queue;
+  Job pool[JOB_POOL_SIZE];
+  unsigned int next_job;
+  unsigned int rng;    // picks steal victims
+};
+typedef struct JobThread JobThread;
+
+static JobThread* threads = NULL;
+static int thread_count = 1;
+static vector<thread> workers;
+static thread_local int thread_index = 0;
+
+/* Jobs sitting in a queue; idle workers sleep while it is zero */
+static atomic<int> queued(0);
+static atomic<bool> stopping(false);
+static mutex sleep_lock;
+static condition_variable wake;
+
+static void finishJob (Job* job)
+{
+  // The last of a job and its children to finish completes the parent
+  while (job && job->unfinished.fetch_sub(1) == 1)
+    job = job->parent;
+}
+
+static void execute (Job* job)
+{
+  if (job->func)
+    job->func(job->data, job->begin, job->end);
+  finishJob(job);
+}
+
+/* Own queue newest first, then the oldest job of another thread */
+static Job* findJob ()
+{
+  JobThread& self = threads[thread_index];
+  {
+    lock_guard<mutex> guard(self.lock);
+    if (!self.queue.empty()) {
+      Job* job = self.queue.back();
+      self.queue.pop_back();
+      queued--;
+      return job;
+    }
+  }
+  int i;
+  for (i=1;i<thread_count;i++) {
+    self.rng ^= self.rng << 13;
+    self.rng ^= self.rng >> 17;
+    self.rng ^= self.rng << 5;
+    int victim = self.rng % thread_count;
+    if (victim == thread_index)
+      continue;
+    JobThread& other = threads[victim];
+    lock_guard<mutex> guard(other.lock);
+    if (!other.queue.empty()) {
+      Job* job = other.queue.front();
+      other.queue.pop_front();
+      queued--;
+      return job;
+    }
+  }
+  return NULL;
+}
+
+static void workerLoop (int index)
+{
+  thread_index = index;
+  while (!stopping) {
+    Job* job = findJob();
+    if (job) {
+      execute(job);
+      continue;
+    }
+    unique_lock<mutex> guard(sleep_lock);
+    wake.wait(guard, [] { return queued > 0 || stopping; });
+  }
+}
+
+int startJobs (int count)
+{
+  stopJobs();
+  // Workers still running when the program exits are stopped first,
+  // a joinable std::thread would abort it
+  static bool stop_at_exit = false;
+  if (!stop_at_exit) {
+    atexit(stopJobs);
+    stop_at_exit = true;
+  }
+  if (count < 0) {
+    int hardware = thread::hardware_concurrency();
+    count = hardware > 1 ? hardware - 1 : 0;
+  }
+  if (count > MAX_JOB_WORKERS)
+    count = MAX_JOB_WORKERS;
+  thread_count = count + 1;
+  threads = new JobThread[thread_count];
+  int i;
+  for (i=0;i<thread_count;i++) {
+    threads[i].next_job = 0;
+    threads[i].rng = 0x9e3779b9u * (i+1);
+  }
+  thread_index = 0;
+  stopping = false;
+  for (i=1;i<thread_count;i++)
+    workers.push_back(thread(workerLoop, i));
+  return thread_count;
+}
+
+void stopJobs ()
+{
+  if (!threads)
+    return;
+  {
+    lock_guard<mutex> guard(sleep_lock);
+    stopping = true;
+  }
+  wake.notify_all();
+  size_t i;
+  for (i=0;i<workers.size();i++)
+    workers[i].join();
+  workers.clear();
+  delete[] threads;
+  threads = NULL;
+  thread_count = 1;
+}
+
+int jobThreads ()
+{
+  return thread_count;
+}
+
+Job* createJob (JobFunc func, void* data, int begin, int end, Job* parent)
+{
+  JobThread& self = threads[thread_index];
+  Job* job = &self.pool[self.next_job++ % JOB_POOL_SIZE];
+  job->func = func;
+  job->data = data;
+  job->begin = begin;
+  job->end = end;
+  job->parent = parent;
+  job->unfinished = 1;
+  if (parent)
+    parent->unfinished++;
+  return job;
+}
+
+void runJob (Job* job)
+{
+  JobThread& self = threads[thread_index];
+  {
+    lock_guard<mutex> guard(self.lock);
+    self.queue.push_back(job);
+  }
+  queued++;
+  // Taking the lock orders this with a worker about to sleep, so the
+  // wakeup cannot slip in between its check and its wait
+  { lock_guard<mutex> guard(sleep_lock); }
+  wake.notify_one();
+}
+
+void waitJob (Job* job)
+{
+  while (job->unfinished > 0) {
+    Job* next = findJob();
+    if (next)
+      execute(next);
+    else
+      this_thread::yield();
+  }
+}
+
+void parallelFor (int count, int grain, JobFunc func, void* data)
+{
+  if (count <= 0)
+    return;
+  if (thread_count == 1 || count <= grain) {
+    func(data, 0, count);
+    return;
+  }
+  // Whole grains per chunk, so that there are at most JOBS_PER_THREAD
+  // chunks per thread
+  int grains = (count + grain - 1) / grain;
+  int max_chunks = thread_count * JOBS_PER_THREAD;
+  int size = (grains + max_chunks - 1) / max_chunks * grain;
+
+  Job* root = createJob(NULL, NULL, 0, 0, NULL);
+  int begin;
+  for (begin=size;begin<count;begin+=size)
+    runJob(createJob(func, data, begin, count - begin < size ? count : begin + size, root));
+  // The first chunk runs here, while the workers pick up the rest
+  func(data, 0, size < count ? size : count);
+  finishJob(root);
+  waitJob(root);
+}
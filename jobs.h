@@ -0,0 +1,54 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+/* Work-stealing job scheduler for splitting per-tick and per-frame loops
+   across cores. Every thread (the one that called startJobs() and the
+   workers) has its own queue: it pushes and pops its jobs at the back,
+   while idle threads steal from the front of the others'. A job counts
+   itself and its unfinished children, so waiting on a parent waits for the
+   whole tree; the waiting thread runs queued jobs meanwhile.
+
+   Only the thread that called startJobs() and jobs themselves may use the
+   scheduler. Without startJobs() (or with no workers) parallelFor() simply
+   runs the loop on the calling thread. */
+
+#include <atomic>
+
+typedef void (*JobFunc) (void* data, int begin, int end);
+
+struct Job {
+  JobFunc func;     // NULL for a job that only groups its children
+  void* data;
+  int begin, end;
+  struct Job* parent;
+  std::atomic<int> unfinished;   // 1 for the job itself, plus each unfinished child
+};
+typedef struct Job Job;
+
+const int MAX_JOB_WORKERS = 63;
+/* Jobs a thread can have in flight; older ones are recycled */
+const int JOB_POOL_SIZE = 4096;
+/* parallelFor() cuts a loop into up to this many jobs per thread, so a
+   thread that falls behind has work to be stolen */
+const int JOBS_PER_THREAD = 4;
+
+/* Start 'workers' worker threads, or with -1 one per hardware thread
+   besides the calling one. Returns the number of threads running jobs,
+   the caller included. The workers are stopped at exit at the latest. */
+int startJobs (int workers);
+void stopJobs ();
+int jobThreads ();
+
+/* A job running func(data, begin, end), as a child of 'parent' (or NULL).
+   It does not run before runJob(). */
+Job* createJob (JobFunc func, void* data, int begin, int end, Job* parent);
+void runJob (Job* job);
+/* Return once the job and all of its children have finished */
+void waitJob (Job* job);
+
+/* func(data, begin, end) over chunks covering [0, count), in parallel.
+   Chunks start at multiples of 'grain' and loops of at most 'grain' items
+   are not split. Returns when every chunk is done. */
+void parallelFor (int count, int grain, JobFunc func, void* data);
+
+#endif
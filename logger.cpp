@@ -0,0 +1,133 @@
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <stdarg.h>
+#include <string.h>
+#include "logger.h"
+using namespace std;
+
+/* Ring capacity in messages, must be a power of two */
+const size_t LOG_RING_SIZE = 1024;
+const size_t LOG_MESSAGE_SIZE = 240;
+/* How long the flusher sleeps when the ring is empty */
+const int LOG_FLUSH_INTERVAL_MS = 5;
+
+struct LogRecord {
+  int level;
+  char text[LOG_MESSAGE_SIZE];
+};
+typedef struct LogRecord LogRecord;
+
+static LogRecord ring[LOG_RING_SIZE];
+/* head is only written by the producer, tail only by the flusher; both
+   count up forever and are masked to index the ring */
+static atomic<size_t> ring_head(0);
+static atomic<size_t> ring_tail(0);
+static atomic<unsigned long> dropped(0);
+
+static int min_level = LOG_INFO;
+static FILE* log_out = NULL;
+static thread flusher;
+static atomic<bool> running(false);
+
+static const char* levelPrefix (int level)
+{
+  switch (level) {
+    case LOG_DEBUG: return "debug: ";
+    case LOG_WARN: return "warning: ";
+    case LOG_ERROR: return "error: ";
+    default: return "";
+  }
+}
+
+/* Write out everything queued so far, returns false if there was nothing */
+static bool drainRing ()
+{
+  size_t tail = ring_tail.load(memory_order_relaxed);
+  size_t head = ring_head.load(memory_order_acquire);
+  if (tail == head)
+    return false;
+  for (;tail!=head;tail++) {
+    const LogRecord& record = ring[tail & (LOG_RING_SIZE-1)];
+    fputs(levelPrefix(record.level), log_out);
+    fputs(record.text, log_out);
+    fputc('\n', log_out);
+  }
+  ring_tail.store(tail, memory_order_release);
+
+  unsigned long lost = dropped.exchange(0);
+  if (lost)
+    fprintf(log_out, "warning: logger dropped %lu messages\n", lost);
+  fflush(log_out);
+  return true;
+}
+
+static void flushLoop ()
+{
+  while (running.load(memory_order_acquire)) {
+    if (!drainRing())
+      this_thread::sleep_for(chrono::milliseconds(LOG_FLUSH_INTERVAL_MS));
+  }
+  drainRing();
+}
+
+void startLogger (FILE* out)
+{
+  if (running)
+    return;
+  log_out = out ? out : stdout;
+  running = true;
+  flusher = thread(flushLoop);
+}
+
+void stopLogger ()
+{
+  if (!running)
+    return;
+  running = false;
+  flusher.join();
+}
+
+void setLogLevel (int level)
+{
+  min_level = level;
+}
+
+int parseLogLevel (const char* name)
+{
+  static const char* names[] = { "debug", "info", "warn", "error" };
+  int i;
+  for (i=0;i<4;i++)
+    if (!strcmp(name, names[i]))
+      return i;
+  return -1;
+}
+
+void logMessage (int level, const char* format, ...)
+{
+  if (level < min_level)
+    return;
+
+  va_list args;
+  va_start(args, format);
+  if (!running) {
+    // No flusher (e.g. before startup or after shutdown): write directly
+    fputs(levelPrefix(level), stdout);
+    vfprintf(stdout, format, args);
+    fputc('\n', stdout);
+    va_end(args);
+    return;
+  }
+
+  size_t head = ring_head.load(memory_order_relaxed);
+  if (head - ring_tail.load(memory_order_acquire) >= LOG_RING_SIZE) {
+    dropped++;
+    va_end(args);
+    return;
+  }
+  LogRecord& record = ring[head & (LOG_RING_SIZE-1)];
+  record.level = level;
+  vsnprintf(record.text, LOG_MESSAGE_SIZE, format, args);
+  va_end(args);
+  ring_head.store(head + 1, memory_order_release);
+}
@@ -0,0 +1,35 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <stdio.h>
+
+/* Asynchronous logger: the game thread formats messages into a lock-free
+   single-producer ring buffer and a background thread writes them out, so
+   a slow stdout (pipe, file, terminal) can never stall a frame. If the ring
+   is full the message is dropped and counted instead of waiting.
+
+   Only one thread may call logMessage() (the game/main thread). */
+
+enum LogLevel {
+  LOG_DEBUG,
+  LOG_INFO,
+  LOG_WARN,
+  LOG_ERROR
+};
+
+/* Start the flusher thread writing to 'out' (stdout if NULL) */
+void startLogger (FILE* out);
+/* Write out everything still queued and stop the flusher thread */
+void stopLogger ();
+
+void setLogLevel (int level);
+/* Parse "debug", "info", "warn" or "error", returns -1 if unknown */
+int parseLogLevel (const char* name);
+
+void logMessage (int level, const char* format, ...)
+#ifdef __GNUC__
+  __attribute__((format(printf, 2, 3)))
+#endif
+  ;
+
+#endif
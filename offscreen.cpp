@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <string.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <glad/glad.h>
+#include "offscreen.h"
+
+static EGLDisplay display = EGL_NO_DISPLAY;
+static EGLContext context = EGL_NO_CONTEXT;
+static GLuint framebuffer = 0;
+static GLuint renderbuffers[2];   // color, depth
+
+static bool hasExtension (const char* extensions, const char* name)
+{
+  size_t len = strlen(name);
+  const char* p = extensions;
+  while (p && (p = strstr(p, name))) {
+    if ((p == extensions || p[-1] == ' ') && (p[len] == ' ' || p[len] == '\0'))
+      return true;
+    p += len;
+  }
+  return false;
+}
+
+static EGLDisplay openDisplay ()
+{
+  const char* client = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+  if (hasExtension(client, "EGL_MESA_platform_surfaceless")) {
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+      (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (getPlatformDisplay) {
+      EGLDisplay d = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+      if (d != EGL_NO_DISPLAY)
+        return d;
+    }
+  }
+  return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+bool createOffscreenContext (int width, int height)
+{
+  display = openDisplay();
+  EGLint major, minor;
+  if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)) {
+    fprintf(stderr, "offscreen: cannot initialize EGL\n");
+    return false;
+  }
+  const char* extensions = eglQueryString(display, EGL_EXTENSIONS);
+  if (!hasExtension(extensions, "EGL_KHR_surfaceless_context")) {
+    fprintf(stderr, "offscreen: EGL %d.%d has no surfaceless contexts\n", major, minor);
+    destroyOffscreenContext();
+    return false;
+  }
+  if (!eglBindAPI(EGL_OPENGL_API)) {
+    fprintf(stderr, "offscreen: EGL cannot create desktop OpenGL contexts\n");
+    destroyOffscreenContext();
+    return false;
+  }
+
+  // No surface is ever created, so any GL-capable config will do
+  EGLConfig config = EGL_NO_CONFIG_KHR;
+  if (!hasExtension(extensions, "EGL_KHR_no_config_context")) {
+    static const EGLint config_attribs[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+    EGLint count = 0;
+    if (!eglChooseConfig(display, config_attribs, &config, 1, &count) || count < 1) {
+      fprintf(stderr, "offscreen: no OpenGL config\n");
+      destroyOffscreenContext();
+      return false;
+    }
+  }
+  // Same context as the window asks GLFW for
+  static const EGLint context_attribs[] = {
+    EGL_CONTEXT_MAJOR_VERSION, 3,
+    EGL_CONTEXT_MINOR_VERSION, 3,
+    EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+    EGL_NONE
+  };
+  context = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attribs);
+  if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+    fprintf(stderr, "offscreen: cannot create a GL 3.3 core context (EGL error 0x%x)\n", eglGetError());
+    destroyOffscreenContext();
+    return false;
+  }
+  gladLoadGLLoader((GLADloadproc) eglGetProcAddress);
+
+  glGenFramebuffers(1, &framebuffer);
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  glGenRenderbuffers(2, renderbuffers);
+  glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[0]);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffers[0]);
+  glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[1]);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, renderbuffers[1]);
+  glReadBuffer(GL_COLOR_ATTACHMENT0);
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    fprintf(stderr, "offscreen: framebuffer incomplete\n");
+    destroyOffscreenContext();
+    return false;
+  }
+  return true;
+}
+
+void destroyOffscreenContext ()
+{
+  if (framebuffer) {
+    glDeleteFramebuffers(1, &framebuffer);
+    glDeleteRenderbuffers(2, renderbuffers);
+    framebuffer = 0;
+  }
+  if (display != EGL_NO_DISPLAY) {
+    eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (context != EGL_NO_CONTEXT)
+      eglDestroyContext(display, context);
+    eglTerminate(display);
+  }
+  display = EGL_NO_DISPLAY;
+  context = EGL_NO_CONTEXT;
+}
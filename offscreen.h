@@ -0,0 +1,13 @@
+#ifndef OFFSCREEN_H
+#define OFFSCREEN_H
+
+/* A GL 3.3 core context without any window, through EGL: the Mesa
+   surfaceless platform when available (no display server needed, renders
+   with llvmpipe on CPU-only machines), the default EGL display otherwise.
+   Rendering goes to a framebuffer object of the requested size, bound as
+   the read and draw framebuffer, so the renderer draws as if to a window. */
+
+bool createOffscreenContext (int width, int height);
+void destroyOffscreenContext ();
+
+#endif
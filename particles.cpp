@@ -0,0 +1,149 @@
+#include <atomic>
+#include <cmath>
+#include "particles.h"
+#include "jobs.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Burst speeds, units per second */
+const float PARTICLE_MIN_SPEED = 0.5;
+const float PARTICLE_MAX_SPEED = 2.5;
+
+/* Separate from gameRand() so effects never change the game's sequence */
+static unsigned int particle_rng = 0x9e3779b9u;
+
+static float particleRand ()
+{
+  particle_rng ^= particle_rng << 13;
+  particle_rng ^= particle_rng >> 17;
+  particle_rng ^= particle_rng << 5;
+  return (particle_rng >> 8) * (1.0f / 16777216.0f);
+}
+
+void initParticles (ParticlePool& pool, int capacity)
+{
+  pool.count = 0;
+  pool.x.resize(capacity);
+  pool.y.resize(capacity);
+  pool.vx.resize(capacity);
+  pool.vy.resize(capacity);
+  pool.life.resize(capacity);
+  pool.kind.resize(capacity);
+}
+
+void emitParticles (ParticlePool& pool, float x, float y, int kind, int n)
+{
+  int capacity = (int)pool.life.size();
+  if (n > capacity - pool.count)
+    n = capacity - pool.count;
+  int i;
+  for (i=pool.count;i<pool.count+n;i++)
+  {
+    float angle = particleRand() * 2 * (float)M_PI;
+    float v = PARTICLE_MIN_SPEED + particleRand() * (PARTICLE_MAX_SPEED - PARTICLE_MIN_SPEED);
+    pool.x[i] = x;
+    pool.y[i] = y;
+    pool.vx[i] = v * cosf(angle);
+    pool.vy[i] = v * sinf(angle);
+    // Stagger the lifetimes a little so a burst thins out instead of vanishing
+    pool.life[i] = PARTICLE_LIFE * (0.5f + 0.5f * particleRand());
+    pool.kind[i] = kind;
+  }
+  pool.count += n;
+}
+
+/* Integrate particles [start, n), returns whether any of them expired */
+static bool moveTail (ParticlePool& pool, int start, int n, float dt)
+{
+  float* x = pool.x.data(), * y = pool.y.data();
+  float* vy = pool.vy.data(), * life = pool.life.data();
+  const float* vx = pool.vx.data();
+  float dv = PARTICLE_GRAVITY * dt;
+  bool expired = false;
+  int i;
+  for (i=start;i<n;i++)
+  {
+    vy[i] -= dv;
+    x[i] += vx[i] * dt;
+    y[i] += vy[i] * dt;
+    life[i] -= dt;
+    expired |= life[i] <= 0;
+  }
+  return expired;
+}
+
+/* Integrate particles [begin, end), returns whether any of them expired.
+   SSE2 is part of every x86-64 CPU, so unlike the block kernels this needs
+   no runtime dispatch. */
+static bool moveRange (ParticlePool& pool, int begin, int end, float dt)
+{
+#ifdef __SSE2__
+  float* x = pool.x.data(), * y = pool.y.data();
+  float* vy = pool.vy.data(), * life = pool.life.data();
+  const float* vx = pool.vx.data();
+  const __m128 t = _mm_set1_ps(dt), dv = _mm_set1_ps(PARTICLE_GRAVITY * dt), zero = _mm_setzero_ps();
+  __m128 expired = zero;
+  int full = begin + ((end - begin) & ~3);
+  int i;
+  for (i=begin;i<full;i+=4)
+  {
+    __m128 v = _mm_sub_ps(_mm_loadu_ps(vy+i), dv);
+    _mm_storeu_ps(vy+i, v);
+    _mm_storeu_ps(x+i, _mm_add_ps(_mm_loadu_ps(x+i), _mm_mul_ps(_mm_loadu_ps(vx+i), t)));
+    _mm_storeu_ps(y+i, _mm_add_ps(_mm_loadu_ps(y+i), _mm_mul_ps(v, t)));
+    __m128 l = _mm_sub_ps(_mm_loadu_ps(life+i), t);
+    _mm_storeu_ps(life+i, l);
+    expired = _mm_or_ps(expired, _mm_cmple_ps(l, zero));
+  }
+  return moveTail(pool, full, end, dt) | (_mm_movemask_ps(expired) != 0);
+#else
+  return moveTail(pool, begin, end, dt);
+#endif
+}
+
+/* Particles moved per job */
+const int PARTICLES_PER_JOB = 16384;
+
+struct ParticleStep {
+  ParticlePool* pool;
+  float dt;
+  std::atomic<bool> expired;
+};
+typedef struct ParticleStep ParticleStep;
+
+static void moveJob (void* data, int begin, int end)
+{
+  ParticleStep& step = *(ParticleStep*)data;
+  if (moveRange(*step.pool, begin, end, step.dt))
+    step.expired = true;
+}
+
+void updateParticles (ParticlePool& pool, float dt)
+{
+  // Most frames nothing expires, then the pool is not touched a second time
+  ParticleStep step;
+  step.pool = &pool;
+  step.dt = dt;
+  step.expired = false;
+  parallelFor(pool.count, PARTICLES_PER_JOB, moveJob, &step);
+  if (!step.expired)
+    return;
+  int i = 0;
+  while (i < pool.count)
+  {
+    if (pool.life[i] > 0) {
+      i++;
+      continue;
+    }
+    // Swap-remove: the last particle takes the dead one's slot
+    int last = --pool.count;
+    pool.x[i] = pool.x[last];
+    pool.y[i] = pool.y[last];
+    pool.vx[i] = pool.vx[last];
+    pool.vy[i] = pool.vy[last];
+    pool.life[i] = pool.life[last];
+    pool.kind[i] = pool.kind[last];
+  }
+}
@@ -0,0 +1,36 @@
+#ifndef PARTICLES_H
+#define PARTICLES_H
+
+/* Short-lived debris for visual feedback (shot and caught blocks). Purely
+   cosmetic: particles use their own random sequence and never feed back
+   into the game, so replays are unaffected. Like the block pool, particles
+   are stored as parallel arrays; live ones are packed in [0, count) and a
+   dead particle is replaced by the last one, so updating and drawing them
+   is a linear pass. */
+
+#include <vector>
+
+const int MAX_PARTICLES = 131072;
+/* Seconds a particle lives, and its downward acceleration */
+const float PARTICLE_LIFE = 0.6;
+const float PARTICLE_GRAVITY = 6;
+
+struct ParticlePool {
+  int count;
+  std::vector<float> x, y;
+  std::vector<float> vx, vy;
+  std::vector<float> life;            // seconds left, dead at 0 or below
+  std::vector<unsigned char> kind;    // BlockKind of the block it came from
+};
+typedef struct ParticlePool ParticlePool;
+
+void initParticles (ParticlePool& pool, int capacity);
+
+/* A burst of n particles flying out of (x, y). Particles past the pool's
+   capacity are dropped. */
+void emitParticles (ParticlePool& pool, float x, float y, int kind, int n);
+
+/* Move every particle by dt seconds and drop the ones that expired */
+void updateParticles (ParticlePool& pool, float dt);
+
+#endif
@@ -0,0 +1,237 @@
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+#include <glad/glad.h>
+#include "profiler.h"
+using namespace std;
+
+struct FrameTimes {
+  double ms[PROFILE_STAGES];   // GPU time is -1 until (unless) its query result arrives
+  int ticks;
+  int state_calls, state_elided;
+};
+typedef struct FrameTimes FrameTimes;
+
+/* Enough queries in flight that reading a result never waits on the GPU */
+const int GPU_QUERIES = 4;
+
+static bool keep_history = false;
+static vector<FrameTimes> history;
+static FrameTimes current;
+static FrameTimes last;
+static int frame_index = 0;
+
+static chrono::steady_clock::time_point stage_start[PROFILE_STAGES];
+static chrono::steady_clock::time_point last_frame_end;
+
+static double window[PROFILE_STAGES][PROFILE_WINDOW];
+static int window_count[PROFILE_STAGES];
+static int window_next[PROFILE_STAGES];
+
+static bool gpu_timing = false;
+static bool gpu_active = false;
+static GLuint queries[GPU_QUERIES];
+static int query_frame[GPU_QUERIES];   // frame a query belongs to, -1 when free
+static int active_query = 0;
+
+/* CPU rasterizers expose timer queries, but their results are meaningless */
+static bool softwareRenderer ()
+{
+  const char* renderer = (const char*)glGetString(GL_RENDERER);
+  if (!renderer)
+    return false;
+  return strstr(renderer, "llvmpipe") || strstr(renderer, "softpipe")
+      || strstr(renderer, "Software Rasterizer") || strstr(renderer, "SwiftShader");
+}
+
+static double elapsedMs (chrono::steady_clock::time_point since)
+{
+  return chrono::duration<double, milli>(chrono::steady_clock::now() - since).count();
+}
+
+static void addSample (int stage, double ms)
+{
+  window[stage][window_next[stage]] = ms;
+  window_next[stage] = (window_next[stage] + 1) % PROFILE_WINDOW;
+  if (window_count[stage] < PROFILE_WINDOW)
+    window_count[stage]++;
+}
+
+static void resetCurrent ()
+{
+  int i;
+  for (i=0;i<PROFILE_STAGES;i++)
+    current.ms[i] = 0;
+  current.ms[PROFILE_GPU] = -1;
+  current.ticks = 0;
+  current.state_calls = current.state_elided = 0;
+}
+
+void initProfiler (bool keep)
+{
+  keep_history = keep;
+  resetCurrent();
+  last_frame_end = chrono::steady_clock::now();
+
+  // GL 3.3 has timer queries in core, but a zero-bit counter means no timer
+  GLint bits = 0;
+  if (GLAD_GL_VERSION_3_3 || GLAD_GL_ARB_timer_query)
+    glGetQueryiv(GL_TIME_ELAPSED, GL_QUERY_COUNTER_BITS, &bits);
+  while (glGetError() != GL_NO_ERROR)
+    ;
+  gpu_timing = bits > 0 && !softwareRenderer();
+  if (gpu_timing) {
+    glGenQueries(GPU_QUERIES, queries);
+    int i;
+    for (i=0;i<GPU_QUERIES;i++)
+      query_frame[i] = -1;
+  }
+  else
+    fprintf(stderr, "profiler: no usable GPU timer, GPU time not measured\n");
+}
+
+bool gpuTimingAvailable ()
+{
+  return gpu_timing;
+}
+
+void profileBegin (int stage)
+{
+  stage_start[stage] = chrono::steady_clock::now();
+}
+
+void profileEnd (int stage)
+{
+  current.ms[stage] += elapsedMs(stage_start[stage]);
+}
+
+void profileAdd (int stage, double ms)
+{
+  current.ms[stage] += ms;
+}
+
+void profileStateCalls (int issued, int elided)
+{
+  current.state_calls += issued;
+  current.state_elided += elided;
+}
+
+void gpuTimerBegin ()
+{
+  gpu_active = false;
+  if (!gpu_timing)
+    return;
+  // If this slot's result is still outstanding the GPU is far behind; skip
+  // the measurement rather than block on it
+  active_query = frame_index % GPU_QUERIES;
+  if (query_frame[active_query] != -1)
+    return;
+  glBeginQuery(GL_TIME_ELAPSED, queries[active_query]);
+  gpu_active = true;
+}
+
+void gpuTimerEnd ()
+{
+  if (!gpu_active)
+    return;
+  glEndQuery(GL_TIME_ELAPSED);
+  query_frame[active_query] = frame_index;
+  gpu_active = false;
+}
+
+/* Collect finished queries without ever waiting for one */
+static void pollGpuQueries ()
+{
+  int i;
+  for (i=0;i<GPU_QUERIES;i++) {
+    if (query_frame[i] == -1)
+      continue;
+    GLint available = 0;
+    glGetQueryObjectiv(queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available)
+      continue;
+    GLuint64 ns = 0;
+    glGetQueryObjectui64v(queries[i], GL_QUERY_RESULT, &ns);
+    double ms = ns / 1e6;
+    addSample(PROFILE_GPU, ms);
+    if (keep_history && query_frame[i] < (int)history.size())
+      history[query_frame[i]].ms[PROFILE_GPU] = ms;
+    else if (query_frame[i] == frame_index)
+      current.ms[PROFILE_GPU] = ms;
+    query_frame[i] = -1;
+  }
+}
+
+void profileEndFrame (int ticks)
+{
+  current.ticks = ticks;
+  current.ms[PROFILE_FRAME] = elapsedMs(last_frame_end);
+  last_frame_end = chrono::steady_clock::now();
+
+  if (gpu_timing)
+    pollGpuQueries();
+
+  int i;
+  for (i=0;i<PROFILE_STAGES;i++)
+    if (i != PROFILE_GPU)
+      addSample(i, current.ms[i]);
+  if (keep_history)
+    history.push_back(current);
+
+  last = current;
+  frame_index++;
+  resetCurrent();
+}
+
+double profilePercentile (int stage, double percentile)
+{
+  int n = window_count[stage];
+  if (n == 0)
+    return 0;
+  double sorted[PROFILE_WINDOW];
+  copy(window[stage], window[stage] + n, sorted);
+  int k = (int)(percentile/100.0*(n-1) + 0.5);
+  nth_element(sorted, sorted + k, sorted + n);
+  return sorted[k];
+}
+
+void profileSummary (char* buffer, size_t size)
+{
+  static const char* names[PROFILE_STAGES] = { "sim", "draw", "swap", "frame", "gpu" };
+  static const int order[] = { PROFILE_FRAME, PROFILE_SIM, PROFILE_DRAW, PROFILE_SWAP, PROFILE_GPU };
+  size_t used = 0;
+  int i;
+  for (i=0;i<PROFILE_STAGES && used<size;i++) {
+    int stage = order[i];
+    if (stage == PROFILE_GPU && !gpu_timing)
+      continue;
+    used += snprintf(buffer + used, size - used, "%s%s %.2f/%.2f/%.2f", i ? " | " : "", names[stage],
+                     profilePercentile(stage, 50), profilePercentile(stage, 95), profilePercentile(stage, 99));
+  }
+  if (used < size)
+    used += snprintf(buffer + used, size - used, " ms (p50/p95/p99)");
+  if (used < size)
+    snprintf(buffer + used, size - used, " | gl calls %d, %d elided", last.state_calls, last.state_elided);
+}
+
+bool writeProfileCSV (const char* path)
+{
+  FILE* f = fopen(path, "w");
+  if (!f) {
+    fprintf(stderr, "Error: cannot write profile to %s\n", path);
+    return false;
+  }
+  fprintf(f, "frame,ticks,sim_ms,draw_ms,swap_ms,frame_ms,gpu_ms,gl_calls,gl_elided\n");
+  size_t i;
+  for (i=0;i<history.size();i++) {
+    const FrameTimes& t = history[i];
+    fprintf(f, "%zu,%d,%.4f,%.4f,%.4f,%.4f,", i, t.ticks, t.ms[PROFILE_SIM], t.ms[PROFILE_DRAW], t.ms[PROFILE_SWAP], t.ms[PROFILE_FRAME]);
+    if (t.ms[PROFILE_GPU] >= 0)
+      fprintf(f, "%.4f", t.ms[PROFILE_GPU]);
+    fprintf(f, ",%d,%d\n", t.state_calls, t.state_elided);
+  }
+  fclose(f);
+  return true;
+}
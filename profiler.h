@@ -0,0 +1,51 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stddef.h>
+
+/* Per-frame timing of the main loop: CPU time spent simulating, building and
+   submitting draw calls and waiting in glfwSwapBuffers, plus GPU time
+   measured with GL_TIME_ELAPSED queries, and the GL state calls issued and
+   elided (see gl_state.h). Keeps rolling p50/p95/p99 over the
+   last PROFILE_WINDOW frames and can dump every frame to a CSV file.
+   Not thread-safe: call it from the thread that owns the GL context only;
+   other threads measure their share themselves and hand it to profileAdd(). */
+
+enum ProfileStage {
+  PROFILE_SIM,     // fixed-step update() calls
+  PROFILE_DRAW,    // building the frame's render commands and submitting them to GL
+  PROFILE_SWAP,    // glfwSwapBuffers, mostly vsync / driver wait
+  PROFILE_FRAME,   // whole loop iteration
+  PROFILE_GPU,     // GPU execution time of the submitted frame
+  PROFILE_STAGES
+};
+
+/* Frames kept for the rolling percentiles */
+const int PROFILE_WINDOW = 240;
+
+/* Call once the GL context is current. GPU timing is switched off when the
+   implementation has no usable timer query (some software renderers). */
+void initProfiler (bool keep_history);
+bool gpuTimingAvailable ();
+
+void profileBegin (int stage);
+void profileEnd (int stage);
+/* Count 'ms' measured elsewhere towards a stage of the current frame */
+void profileAdd (int stage, double ms);
+/* GL state calls of the current frame, issued and skipped as redundant */
+void profileStateCalls (int issued, int elided);
+/* Bracket the GL commands of a frame to measure their GPU time */
+void gpuTimerBegin ();
+void gpuTimerEnd ();
+/* Close the current frame and collect any GPU results that are ready */
+void profileEndFrame (int ticks);
+
+/* Percentile (0-100) of a stage over the rolling window, in milliseconds */
+double profilePercentile (int stage, double percentile);
+/* One-line p50/p95/p99 summary, e.g. for the window title */
+void profileSummary (char* buffer, size_t size);
+
+/* Write every recorded frame as CSV, needs initProfiler(true) */
+bool writeProfileCSV (const char* path);
+
+#endif
@@ -0,0 +1,33 @@
+#include <string.h>
+#include "render_commands.h"
+
+void sortRenderCommands (RenderFrame& frame)
+{
+  std::vector<RenderCommand>& from = frame.commands;
+  std::vector<RenderCommand>& to = frame.scratch;
+  size_t n = from.size();
+  if (n < 2)
+    return;
+  to.resize(n);
+  int shift;
+  size_t i;
+  for (shift=0;shift<64;shift+=8) {
+    size_t start[256];
+    memset(start, 0, sizeof(start));
+    for (i=0;i<n;i++)
+      start[(from[i].key >> shift) & 0xff]++;
+    if (start[(from[0].key >> shift) & 0xff] == n)
+      continue;
+    // Counts to the first slot of each digit
+    size_t sum = 0;
+    int digit;
+    for (digit=0;digit<256;digit++) {
+      size_t count = start[digit];
+      start[digit] = sum;
+      sum += count;
+    }
+    for (i=0;i<n;i++)
+      to[start[(from[i].key >> shift) & 0xff]++] = from[i];
+    from.swap(to);
+  }
+}
@@ -0,0 +1,75 @@
+#ifndef RENDER_COMMANDS_H
+#define RENDER_COMMANDS_H
+
+/* Everything one frame draws, as a list of commands built from the game
+   state and submitted to GL later, possibly on another thread (see
+   render_thread.h). Plain data with no GL: meshes are referred to by their
+   index in the renderer's tables. Commands may be added in any order and
+   are sorted by key before drawing, which brings the draws that share GL
+   state together. */
+
+#include <vector>
+#include <stdint.h>
+#include <glm/glm.hpp>
+
+/* Per-instance data for the falling blocks and the particles */
+struct BlockInstance {
+  float x, y;        // translation
+  float rotation;    // degrees about z
+  float r, g, b;     // color
+};
+typedef struct BlockInstance BlockInstance;
+
+enum RenderCommandType {
+  RENDER_INSTANCES,  // instanced mesh 'mesh' once per instance in [first, first+count)
+  RENDER_OBJECT      // scene mesh 'mesh' with model matrix number 'first'
+};
+
+struct RenderCommand {
+  uint64_t key;   // see renderKey()
+  int type;
+  int mesh;
+  int first;
+  int count;
+};
+typedef struct RenderCommand RenderCommand;
+
+/* Sort key of a command, most significant field first: the layer, which
+   is the depth (later layers are drawn over earlier ones), then the
+   program, the mesh and the fill mode, each numbered by the renderer.
+   Draws within a layer are grouped by state and may be reordered, draws
+   with equal keys keep the order they were added in. */
+inline uint64_t renderKey (int layer, int program, int mesh, int fill_mode)
+{
+  return (uint64_t)(layer & 0xff) << 56 | (uint64_t)(program & 0xff) << 48
+       | (uint64_t)(mesh & 0xffff) << 32 | (uint64_t)(fill_mode & 0xff) << 24;
+}
+
+struct RenderFrame {
+  std::vector<RenderCommand> commands;   // in drawing order once sorted
+  std::vector<RenderCommand> scratch;    // for sortRenderCommands()
+  std::vector<BlockInstance> instances;
+  std::vector<glm::mat4> models;
+  int viewport_width, viewport_height;
+  /* The building thread's share of the frame, for the profiler */
+  int ticks;
+  double sim_ms, build_ms;
+};
+typedef struct RenderFrame RenderFrame;
+
+/* Empty the lists, keeping their memory for the next frame */
+inline void clearRenderFrame (RenderFrame& frame)
+{
+  frame.commands.clear();
+  frame.instances.clear();
+  frame.models.clear();
+  frame.ticks = 0;
+  frame.sim_ms = frame.build_ms = 0;
+}
+
+/* Stable LSD radix sort of the commands by key, one byte per pass. Passes
+   over a byte all keys share are skipped, so the unused low bits of the
+   keys cost nothing. */
+void sortRenderCommands (RenderFrame& frame);
+
+#endif
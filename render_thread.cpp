@@ -0,0 +1,95 @@
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "render_thread.h"
+using namespace std;
+
+static RenderHooks hooks;
+static bool threaded = false;
+static thread renderer;
+
+/* Frames ping-pong between the two threads, guarded by 'frame_lock':
+   'filling' is being built by the game loop, 'ready' was handed over and
+   not yet picked up, 'drawing' is being rendered; -1 for none */
+static RenderFrame frames[2];
+static mutex frame_lock;
+static condition_variable frame_changed;
+static int filling = 0;
+static int ready = -1;
+static int drawing = -1;
+static bool stopping = false;
+
+static void renderLoop ()
+{
+  hooks.attach();
+  unique_lock<mutex> guard(frame_lock);
+  while (true) {
+    frame_changed.wait(guard, [] { return ready >= 0 || stopping; });
+    if (ready < 0)
+      break;
+    drawing = ready;
+    ready = -1;
+    frame_changed.notify_all();
+    guard.unlock();
+    hooks.render(frames[drawing]);
+    guard.lock();
+    drawing = -1;
+    frame_changed.notify_all();
+  }
+  guard.unlock();
+  hooks.detach();
+}
+
+void startRenderThread (const RenderHooks& render_hooks, bool run_threaded)
+{
+  hooks = render_hooks;
+  threaded = run_threaded;
+  filling = 0;
+  ready = drawing = -1;
+  stopping = false;
+  if (threaded)
+    renderer = thread(renderLoop);
+  else
+    hooks.attach();
+}
+
+void stopRenderThread ()
+{
+  if (!threaded) {
+    hooks.detach();
+    return;
+  }
+  {
+    lock_guard<mutex> guard(frame_lock);
+    stopping = true;
+  }
+  frame_changed.notify_all();
+  renderer.join();
+  threaded = false;
+}
+
+RenderFrame& beginRenderFrame ()
+{
+  if (threaded) {
+    unique_lock<mutex> guard(frame_lock);
+    frame_changed.wait(guard, [] { return drawing != filling; });
+  }
+  clearRenderFrame(frames[filling]);
+  return frames[filling];
+}
+
+void endRenderFrame ()
+{
+  if (!threaded) {
+    hooks.render(frames[filling]);
+    return;
+  }
+  {
+    // The previous frame must have been picked up, frames are never dropped
+    unique_lock<mutex> guard(frame_lock);
+    frame_changed.wait(guard, [] { return ready < 0; });
+    ready = filling;
+    filling = 1 - filling;
+  }
+  frame_changed.notify_all();
+}
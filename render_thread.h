@@ -0,0 +1,35 @@
+#ifndef RENDER_THREAD_H
+#define RENDER_THREAD_H
+
+/* Hands the frames built by the game loop to a render thread that owns the
+   GL context, so the next frame is simulated and built while the previous
+   one is submitted and waits on the swap. Two frames are double-buffered:
+   the game loop fills one while the render thread draws the other, and
+   endRenderFrame() waits only when the render thread has not yet picked up
+   the frame before, which keeps the loop at most one frame ahead and paced
+   by the display. Knows nothing of GL; the hooks do the drawing.
+
+   Without a thread (threaded = false) the hooks run inline on the calling
+   thread, frame by frame. */
+
+#include "render_commands.h"
+
+struct RenderHooks {
+  void (*attach) ();                   // before the first frame: make the context current
+  void (*render) (RenderFrame& frame); // submit and present one frame
+  void (*detach) ();                   // after the last frame: release the context
+};
+typedef struct RenderHooks RenderHooks;
+
+/* The calling thread must not have the GL context current when threaded */
+void startRenderThread (const RenderHooks& hooks, bool threaded);
+/* Render the frame handed over last, if any, then stop the thread */
+void stopRenderThread ();
+
+/* The frame to fill next, cleared. Waits while the render thread still
+   draws it. */
+RenderFrame& beginRenderFrame ();
+/* Hand the frame from beginRenderFrame() over to be drawn */
+void endRenderFrame ();
+
+#endif
@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <string.h>
+#include "game.h"
+#include "replay.h"
+
+/* Bumped whenever a change to the simulation stops old replays reproducing
+   (2: the laser became a ray cast, 3: block pool with a block count) */
+const unsigned short REPLAY_VERSION = 3;
+
+static FILE* record_file = NULL;
+static unsigned int record_last_tick = 0;
+
+static void writeU16 (FILE* f, unsigned int v)
+{
+  fputc(v & 0xff, f);
+  fputc((v >> 8) & 0xff, f);
+}
+
+static void writeU32 (FILE* f, unsigned int v)
+{
+  writeU16(f, v & 0xffff);
+  writeU16(f, v >> 16);
+}
+
+/* LEB128: 7 bits per byte, high bit set on all but the last byte */
+static void writeVarint (FILE* f, unsigned int v)
+{
+  while (v >= 0x80) {
+    fputc((v & 0x7f) | 0x80, f);
+    v >>= 7;
+  }
+  fputc(v, f);
+}
+
+static bool readU16 (FILE* f, unsigned int* v)
+{
+  int lo = fgetc(f), hi = fgetc(f);
+  if (lo == EOF || hi == EOF)
+    return false;
+  *v = lo | (hi << 8);
+  return true;
+}
+
+static bool readU32 (FILE* f, unsigned int* v)
+{
+  unsigned int lo, hi;
+  if (!readU16(f, &lo) || !readU16(f, &hi))
+    return false;
+  *v = lo | (hi << 16);
+  return true;
+}
+
+static bool readVarint (FILE* f, unsigned int* v)
+{
+  unsigned int result = 0;
+  int shift;
+  for (shift=0;shift<35;shift+=7) {
+    int c = fgetc(f);
+    if (c == EOF)
+      return false;
+    result |= (unsigned int)(c & 0x7f) << shift;
+    if (!(c & 0x80)) {
+      *v = result;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool startRecording (const char* path, unsigned int seed)
+{
+  if (record_file)
+    fclose(record_file);
+  record_file = fopen(path, "wb");
+  if (!record_file) {
+    fprintf(stderr, "Error: cannot create replay file %s\n", path);
+    return false;
+  }
+  fwrite("A1RP", 1, 4, record_file);
+  writeU16(record_file, REPLAY_VERSION);
+  writeU16(record_file, (unsigned int)TICK_RATE);
+  writeU32(record_file, seed);
+  writeU32(record_file, blockCount());
+  record_last_tick = 0;
+  return true;
+}
+
+bool isRecording ()
+{
+  return record_file != NULL;
+}
+
+void recordAction (unsigned int tick, int action)
+{
+  if (!record_file)
+    return;
+  writeVarint(record_file, tick - record_last_tick);
+  fputc(action, record_file);
+  record_last_tick = tick;
+}
+
+void stopRecording (unsigned int tick, int points)
+{
+  if (!record_file)
+    return;
+  writeVarint(record_file, tick - record_last_tick);
+  fputc(REPLAY_END, record_file);
+  writeU32(record_file, (unsigned int)points);
+  fclose(record_file);
+  record_file = NULL;
+}
+
+bool loadReplay (const char* path, Replay& replay)
+{
+  FILE* f = fopen(path, "rb");
+  if (!f) {
+    fprintf(stderr, "Error: cannot open replay file %s\n", path);
+    return false;
+  }
+
+  char magic[4];
+  unsigned int version, tick_rate, blocks;
+  if (fread(magic, 1, 4, f) != 4 || memcmp(magic, "A1RP", 4) != 0
+      || !readU16(f, &version) || !readU16(f, &tick_rate)
+      || !readU32(f, &replay.seed) || !readU32(f, &blocks)) {
+    fprintf(stderr, "Error: %s is not a replay file\n", path);
+    fclose(f);
+    return false;
+  }
+  if (version != REPLAY_VERSION || tick_rate != (unsigned int)TICK_RATE) {
+    fprintf(stderr, "Error: %s has version %u at %u Hz, expected version %u at %g Hz\n", path, version, tick_rate, REPLAY_VERSION, TICK_RATE);
+    fclose(f);
+    return false;
+  }
+
+  replay.blocks = (int)blocks;
+  replay.events.clear();
+  replay.complete = false;
+  replay.final_points = 0;
+  unsigned int tick = 0, delta;
+  while (readVarint(f, &delta)) {
+    int action = fgetc(f);
+    if (action == EOF)
+      break;
+    tick += delta;
+    if (action == REPLAY_END) {
+      unsigned int final_points;
+      replay.complete = readU32(f, &final_points);
+      replay.final_points = (int)final_points;
+      break;
+    }
+    ReplayEvent event = { tick, action };
+    replay.events.push_back(event);
+  }
+  // A recording cut short (crash, kill) still replays up to its last action
+  replay.end_tick = tick;
+  fclose(f);
+  return true;
+}
+
+int playReplay (const Replay& replay)
+{
+  setBlockCount(replay.blocks);
+  resetGame(replay.seed);
+  size_t next = 0;
+  while (!game_over && game_tick < replay.end_tick) {
+    while (next < replay.events.size() && replay.events[next].tick <= game_tick)
+      gameAction(replay.events[next++].action);
+    update();
+  }
+  return points;
+}
@@ -0,0 +1,48 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <vector>
+
+/* Record/replay of a game as its seed plus the timestamped player actions.
+   The simulation is deterministic for a given seed and action sequence, so
+   replaying the file reproduces the original game tick for tick.
+
+   File layout (little endian):
+     header   "A1RP", u16 version, u16 tick rate, u32 seed, u32 block count
+     events   varint tick delta since the previous event, u8 action
+     end      varint tick delta, u8 REPLAY_END, i32 final points */
+
+const unsigned char REPLAY_END = 0xff;
+
+struct ReplayEvent {
+  unsigned int tick;    // game_tick at which the action was applied
+  int action;           // GameAction
+};
+typedef struct ReplayEvent ReplayEvent;
+
+struct Replay {
+  unsigned int seed;
+  int blocks;           // blockCount() the game was played with
+  std::vector<ReplayEvent> events;
+  unsigned int end_tick;
+  int final_points;
+  bool complete;        // false if the recording was cut off before its end record
+};
+typedef struct Replay Replay;
+
+/* Start writing a new recording of a game with the current blockCount(),
+   returns false if the file can't be created */
+bool startRecording (const char* path, unsigned int seed);
+bool isRecording ();
+/* Log an action applied before simulating tick 'tick' (no-op if not recording) */
+void recordAction (unsigned int tick, int action);
+/* Write the end record and close the file */
+void stopRecording (unsigned int tick, int points);
+
+/* Read a recording, returns false if the file is missing or not a replay */
+bool loadReplay (const char* path, Replay& replay);
+
+/* Run the recorded game from its seed as fast as possible, returns final points */
+int playReplay (const Replay& replay);
+
+#endif
@@ -0,0 +1,140 @@
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "shader_cache.h"
+using namespace std;
+
+static bool cache_enabled = false;
+static string cache_dir;
+
+/* FNV-1a, 64 bit */
+static uint64_t hashBytes (uint64_t h, const void* data, size_t size)
+{
+  const unsigned char* p = (const unsigned char*)data;
+  size_t i;
+  for (i=0;i<size;i++) {
+    h ^= p[i];
+    h *= 1099511628211ull;
+  }
+  return h;
+}
+
+/* Hash a string including its terminator, so "ab"+"c" and "a"+"bc" differ */
+static uint64_t hashString (uint64_t h, const char* s)
+{
+  return hashBytes(h, s ? s : "", s ? strlen(s) + 1 : 1);
+}
+
+static string entryPath (uint64_t key)
+{
+  char name[32];
+  snprintf(name, sizeof(name), "/%016llx.bin", (unsigned long long)key);
+  return cache_dir + name;
+}
+
+void initShaderCache (const char* dir)
+{
+  cache_enabled = false;
+  if (!dir)
+    return;
+  if (!GLAD_GL_VERSION_4_1 && !GLAD_GL_ARB_get_program_binary)
+    return;
+  GLint formats = 0;
+  glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+  if (formats <= 0) {
+    fprintf(stderr, "shader cache: driver has no program binary format, cache disabled\n");
+    return;
+  }
+  // Already existing is fine; any other failure shows up when writing
+  mkdir(dir, 0755);
+  cache_dir = dir;
+  cache_enabled = true;
+}
+
+bool shaderCacheEnabled ()
+{
+  return cache_enabled;
+}
+
+uint64_t programCacheKey (const string& vertex_source, const string& fragment_source)
+{
+  uint64_t h = 14695981039346656037ull;
+  h = hashString(h, vertex_source.c_str());
+  h = hashString(h, fragment_source.c_str());
+  h = hashString(h, (const char*)glGetString(GL_VENDOR));
+  h = hashString(h, (const char*)glGetString(GL_RENDERER));
+  h = hashString(h, (const char*)glGetString(GL_VERSION));
+  return h;
+}
+
+/* Entry layout: "A1PB", binary format (u32), binary length (u32), binary */
+GLuint loadCachedProgram (uint64_t key)
+{
+  if (!cache_enabled)
+    return 0;
+  FILE* f = fopen(entryPath(key).c_str(), "rb");
+  if (!f)
+    return 0;
+  char magic[4];
+  unsigned int header[2];
+  vector<char> binary;
+  bool ok = fread(magic, 1, 4, f) == 4 && memcmp(magic, "A1PB", 4) == 0
+         && fread(header, sizeof(header), 1, f) == 1 && header[1] > 0;
+  if (ok) {
+    binary.resize(header[1]);
+    ok = fread(&binary[0], 1, binary.size(), f) == binary.size();
+  }
+  fclose(f);
+  if (!ok) {
+    fprintf(stderr, "shader cache: ignoring damaged entry %s\n", entryPath(key).c_str());
+    return 0;
+  }
+
+  GLuint program = glCreateProgram();
+  glProgramBinary(program, header[0], &binary[0], binary.size());
+  GLint linked = GL_FALSE;
+  glGetProgramiv(program, GL_LINK_STATUS, &linked);
+  if (!linked) {
+    // Typically a driver update that kept the version string
+    glDeleteProgram(program);
+    return 0;
+  }
+  return program;
+}
+
+void storeCachedProgram (uint64_t key, GLuint program)
+{
+  if (!cache_enabled)
+    return;
+  GLint length = 0;
+  glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0)
+    return;
+  vector<char> binary(length);
+  GLenum format = 0;
+  glGetProgramBinary(program, length, &length, &format, &binary[0]);
+  if (length <= 0)
+    return;
+
+  // Write under a private name and rename, so instances launched in
+  // parallel never read a half-written entry
+  string path = entryPath(key);
+  char suffix[32];
+  snprintf(suffix, sizeof(suffix), ".%d.tmp", (int)getpid());
+  string temp = path + suffix;
+  FILE* f = fopen(temp.c_str(), "wb");
+  if (!f) {
+    fprintf(stderr, "shader cache: cannot write %s\n", temp.c_str());
+    return;
+  }
+  unsigned int header[2] = { format, (unsigned int)length };
+  bool ok = fwrite("A1PB", 1, 4, f) == 4 && fwrite(header, sizeof(header), 1, f) == 1
+         && fwrite(&binary[0], 1, length, f) == (size_t)length;
+  ok = fclose(f) == 0 && ok;
+  if (!ok || rename(temp.c_str(), path.c_str()) != 0) {
+    fprintf(stderr, "shader cache: cannot write %s\n", path.c_str());
+    remove(temp.c_str());
+  }
+}
@@ -0,0 +1,33 @@
+#ifndef SHADER_CACHE_H
+#define SHADER_CACHE_H
+
+#include <string>
+#include <stdint.h>
+#include <glad/glad.h>
+
+/* On-disk cache of linked shader programs, so a launch after the first
+   skips compiling and linking. Entries are glGetProgramBinary() output,
+   one file per program named after a hash of its sources and of the
+   driver (GL_VENDOR, GL_RENDERER, GL_VERSION): editing a shader or
+   changing driver simply misses. A binary the driver refuses is ignored
+   and the program is built from source again, which rewrites the entry. */
+
+/* Default location, relative to the working directory like the shaders */
+const char* const SHADER_CACHE_DIR = ".shader_cache";
+
+/* Call once the GL context is current. dir NULL disables the cache. It
+   also stays off when the driver offers no program binary format. */
+void initShaderCache (const char* dir);
+bool shaderCacheEnabled ();
+
+uint64_t programCacheKey (const std::string& vertex_source, const std::string& fragment_source);
+
+/* A linked program from the cached binary, 0 if none or the driver
+   rejects it */
+GLuint loadCachedProgram (uint64_t key);
+
+/* Save the binary of a program just linked from source. Set
+   GL_PROGRAM_BINARY_RETRIEVABLE_HINT on it before linking. */
+void storeCachedProgram (uint64_t key, GLuint program);
+
+#endif
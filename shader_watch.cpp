@@ -0,0 +1,196 @@
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "shader_watch.h"
+using namespace std;
+
+#ifdef __linux__
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+
+/* Editors often save in several steps (truncate, write, rename); wait this
+   long after an event for the file to settle before reading it */
+const int WATCH_SETTLE_MS = 50;
+
+struct WatchedFile {
+  string path;
+  string dir;    // directory watched for it
+  string name;   // file name inside dir
+  int wd;        // inotify watch of dir
+  bool dirty;    // written since the last read
+};
+typedef struct WatchedFile WatchedFile;
+
+static vector<WatchedFile> watched;
+static int inotify_fd = -1;
+static int wake_fd = -1;   // eventfd to stop the thread
+static thread watcher;
+
+/* Sources handed to the render thread, guarded by 'pending_lock'; 'pending'
+   lets the render thread skip the lock while nothing changed */
+static mutex pending_lock;
+static vector<ShaderFile> pending_files;
+static atomic<bool> pending(false);
+
+static bool readFile (const string& path, string& out)
+{
+  FILE* f = fopen(path.c_str(), "rb");
+  if (!f)
+    return false;
+  out.clear();
+  char buffer[4096];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+    out.append(buffer, n);
+  fclose(f);
+  return true;
+}
+
+/* Mark the watched files named by the queued events, returns whether any
+   of them changed */
+static bool drainEvents ()
+{
+  // Aligned for struct inotify_event, as inotify(7) recommends
+  char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  bool hit = false;
+  ssize_t len;
+  while ((len = read(inotify_fd, buffer, sizeof(buffer))) > 0) {
+    const char* p = buffer;
+    while (p < buffer + len) {
+      const struct inotify_event* event = (const struct inotify_event*)p;
+      size_t i;
+      for (i=0;i<watched.size();i++)
+        if (event->len && watched[i].wd == event->wd && watched[i].name == event->name) {
+          watched[i].dirty = true;
+          hit = true;
+        }
+      p += sizeof(struct inotify_event) + event->len;
+    }
+  }
+  return hit;
+}
+
+/* Read every watched file and publish the snapshot */
+static void publishSources ()
+{
+  vector<ShaderFile> files(watched.size());
+  size_t i;
+  for (i=0;i<watched.size();i++) {
+    files[i].path = watched[i].path;
+    if (!readFile(watched[i].path, files[i].source))
+      // Mid-rename or deleted: skip this round, the next event retries
+      return;
+  }
+  for (i=0;i<watched.size();i++) {
+    files[i].changed = watched[i].dirty;
+    watched[i].dirty = false;
+  }
+  lock_guard<mutex> guard(pending_lock);
+  // Keep the changed marks of a snapshot the render thread has not taken yet
+  if (pending.load(memory_order_relaxed))
+    for (i=0;i<files.size() && i<pending_files.size();i++)
+      files[i].changed = files[i].changed || pending_files[i].changed;
+  pending_files.swap(files);
+  pending.store(true, memory_order_release);
+}
+
+static void watchLoop ()
+{
+  struct pollfd fds[2] = { { inotify_fd, POLLIN, 0 }, { wake_fd, POLLIN, 0 } };
+  for (;;) {
+    if (poll(fds, 2, -1) < 0)
+      continue;
+    if (fds[1].revents)
+      return;
+    if (!drainEvents())
+      continue;
+    // Let the save finish, and fold its remaining events into this reload
+    while (poll(fds, 1, WATCH_SETTLE_MS) > 0)
+      drainEvents();
+    publishSources();
+  }
+}
+
+bool startShaderWatch (const vector<string>& paths)
+{
+  if (inotify_fd >= 0)
+    return true;
+  inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  wake_fd = eventfd(0, EFD_CLOEXEC);
+  if (inotify_fd < 0 || wake_fd < 0) {
+    fprintf(stderr, "shader watch: cannot create inotify instance\n");
+    stopShaderWatch();
+    return false;
+  }
+  watched.clear();
+  size_t i;
+  for (i=0;i<paths.size();i++) {
+    WatchedFile file;
+    file.path = paths[i];
+    size_t slash = paths[i].rfind('/');
+    file.dir = slash == string::npos ? "." : paths[i].substr(0, slash);
+    file.name = slash == string::npos ? paths[i] : paths[i].substr(slash + 1);
+    file.dirty = false;
+    // Watch the directory, not the file: saving by rename replaces the inode.
+    // Adding the same directory again returns the same watch.
+    file.wd = inotify_add_watch(inotify_fd, file.dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (file.wd < 0) {
+      fprintf(stderr, "shader watch: cannot watch %s\n", file.dir.c_str());
+      stopShaderWatch();
+      return false;
+    }
+    watched.push_back(file);
+  }
+  watcher = thread(watchLoop);
+  return true;
+}
+
+void stopShaderWatch ()
+{
+  if (watcher.joinable()) {
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) != sizeof(one))
+      perror("shader watch");
+    watcher.join();
+  }
+  if (inotify_fd >= 0)
+    close(inotify_fd);
+  if (wake_fd >= 0)
+    close(wake_fd);
+  inotify_fd = wake_fd = -1;
+}
+
+bool takeShaderChanges (vector<ShaderFile>& files)
+{
+  if (!pending.load(memory_order_acquire))
+    return false;
+  lock_guard<mutex> guard(pending_lock);
+  files.swap(pending_files);
+  pending_files.clear();
+  pending.store(false, memory_order_relaxed);
+  return true;
+}
+
+#else
+
+bool startShaderWatch (const vector<string>& paths)
+{
+  fprintf(stderr, "shader watch: only supported on Linux\n");
+  return false;
+}
+
+void stopShaderWatch ()
+{
+}
+
+bool takeShaderChanges (vector<ShaderFile>& files)
+{
+  return false;
+}
+
+#endif
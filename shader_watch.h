@@ -0,0 +1,31 @@
+#ifndef SHADER_WATCH_H
+#define SHADER_WATCH_H
+
+#include <string>
+#include <vector>
+
+/* Shader hot reload, the file system half. A background thread sleeps on
+   inotify until one of the watched files is written (or replaced, as most
+   editors save), then reads every watched file and leaves the sources for
+   the render thread. The render thread polls with takeShaderChanges() once
+   per frame, which is a single atomic load while nothing changed, and
+   rebuilds the programs itself since only it owns the GL context.
+
+   Only available on Linux; elsewhere startShaderWatch() fails. */
+
+struct ShaderFile {
+  std::string path;
+  std::string source;
+  bool changed;   // written since the previous takeShaderChanges()
+};
+typedef struct ShaderFile ShaderFile;
+
+/* Watch these files (paths as passed to the shader loader) */
+bool startShaderWatch (const std::vector<std::string>& paths);
+void stopShaderWatch ();
+
+/* If any watched file changed, fill 'files' with the current source of
+   every watched file and return true */
+bool takeShaderChanges (std::vector<ShaderFile>& files);
+
+#endif
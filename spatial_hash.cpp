@@ -0,0 +1,82 @@
+#include "spatial_hash.h"
+using namespace std;
+
+static int bucketOf (const SpatialHash& hash, int cx, int cy)
+{
+  // Large primes to spread neighbouring cells over the table
+  unsigned int h = (unsigned int)cx * 73856093u ^ (unsigned int)cy * 19349663u;
+  return (int)(h & hash.bucket_mask);
+}
+
+void initSpatialHash (SpatialHash& hash, float cell_size, int bucket_count, int capacity)
+{
+  int n = 1;
+  while (n < bucket_count)
+    n *= 2;
+  hash.cell_size = cell_size;
+  hash.inv_cell_size = 1 / cell_size;
+  hash.bucket_mask = n - 1;
+  hash.buckets.assign(n, vector<int>());
+  SpatialEntry absent = { 0, 0, 0, 0, -1, -1 };
+  hash.objects.assign(capacity, absent);
+}
+
+void clearSpatialHash (SpatialHash& hash)
+{
+  size_t i;
+  for (i=0;i<hash.buckets.size();i++)
+    hash.buckets[i].clear();
+  for (i=0;i<hash.objects.size();i++) {
+    hash.objects[i].bucket = -1;
+    hash.objects[i].slot = -1;
+  }
+}
+
+void removeObject (SpatialHash& hash, int id)
+{
+  SpatialEntry& e = hash.objects[id];
+  if (e.bucket < 0)
+    return;
+  // Swap-remove: the last id in the bucket takes over the freed slot
+  vector<int>& ids = hash.buckets[e.bucket];
+  int last = ids.back();
+  ids[e.slot] = last;
+  hash.objects[last].slot = e.slot;
+  ids.pop_back();
+  e.bucket = -1;
+  e.slot = -1;
+}
+
+void relocateObject (SpatialHash& hash, int id, float x, float y)
+{
+  removeObject(hash, id);
+  SpatialEntry& e = hash.objects[id];
+  e.cx = spatialCell(hash, x);
+  e.cy = spatialCell(hash, y);
+  e.min_x = e.cx * hash.cell_size;
+  e.min_y = e.cy * hash.cell_size;
+  e.bucket = bucketOf(hash, e.cx, e.cy);
+  e.slot = (int)hash.buckets[e.bucket].size();
+  hash.buckets[e.bucket].push_back(id);
+}
+
+void queryRect (const SpatialHash& hash, float min_x, float min_y, float max_x, float max_y, vector<int>& out)
+{
+  int x0 = spatialCell(hash, min_x), x1 = spatialCell(hash, max_x);
+  int y0 = spatialCell(hash, min_y), y1 = spatialCell(hash, max_y);
+  int cx, cy;
+  for (cx=x0;cx<=x1;cx++) {
+    for (cy=y0;cy<=y1;cy++) {
+      // Only report ids that really live in this cell: that drops objects
+      // from other cells hashed to the same bucket, and a bucket reached
+      // through two cells of the rectangle cannot report an id twice
+      const vector<int>& ids = hash.buckets[bucketOf(hash, cx, cy)];
+      size_t i;
+      for (i=0;i<ids.size();i++) {
+        const SpatialEntry& e = hash.objects[ids[i]];
+        if (e.cx == cx && e.cy == cy)
+          out.push_back(ids[i]);
+      }
+    }
+  }
+}
@@ -0,0 +1,66 @@
+#ifndef SPATIAL_HASH_H
+#define SPATIAL_HASH_H
+
+#include <vector>
+
+/* Uniform-grid spatial hash over object centers. Objects are small ids
+   (0..capacity-1); each sits in exactly one cell, the one containing its
+   center. moveObject() only touches the buckets when an object crosses a
+   cell boundary, so keeping the grid in sync with moving objects is cheap.
+
+   Queries return every object whose center lies in the cells overlapping
+   the query rectangle, which the caller should pad by the largest object
+   half-extent. Results can include false positives (hash collisions, the
+   rest of a border cell), so callers still run their exact test. */
+
+/* Where an object currently lives. The cell's lower corner is cached so
+   the per-tick "did it leave its cell" test is a few float compares. */
+struct SpatialEntry {
+  float min_x, min_y;
+  int cx, cy;
+  int bucket;   // -1 if the object is not in the hash
+  int slot;     // index of the object inside its bucket
+};
+typedef struct SpatialEntry SpatialEntry;
+
+struct SpatialHash {
+  float cell_size;
+  float inv_cell_size;
+  unsigned int bucket_mask;                 // bucket count - 1, a power of two
+  std::vector< std::vector<int> > buckets;  // object ids per bucket
+  std::vector<SpatialEntry> objects;        // indexed by object id
+};
+typedef struct SpatialHash SpatialHash;
+
+/* bucket_count is rounded up to a power of two */
+void initSpatialHash (SpatialHash& hash, float cell_size, int bucket_count, int capacity);
+void clearSpatialHash (SpatialHash& hash);
+
+/* Cell coordinate of a position; floor() without the libm call */
+inline int spatialCell (const SpatialHash& hash, float v)
+{
+  float f = v * hash.inv_cell_size;
+  int i = (int)f;
+  return i - (f < i);
+}
+
+/* Slow path of moveObject(): (re)insert the object into the cell of (x, y) */
+void relocateObject (SpatialHash& hash, int id, float x, float y);
+void removeObject (SpatialHash& hash, int id);
+
+/* Insert the object, or move it if it is already in the hash. Called for
+   every object every tick, so the common "same cell" case stays inline. */
+inline void moveObject (SpatialHash& hash, int id, float x, float y)
+{
+  const SpatialEntry& e = hash.objects[id];
+  if (e.bucket >= 0 && x >= e.min_x && x < e.min_x + hash.cell_size
+      && y >= e.min_y && y < e.min_y + hash.cell_size)
+    return;
+  relocateObject(hash, id, x, y);
+}
+
+/* Append to 'out' the ids of objects whose center may lie in the rectangle.
+   Each object is reported at most once per call. */
+void queryRect (const SpatialHash& hash, float min_x, float min_y, float max_x, float max_y, std::vector<int>& out);
+
+#endif
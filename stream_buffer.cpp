@@ -0,0 +1,154 @@
+#include <stdio.h>
+#include "stream_buffer.h"
+#include "gl_state.h"
+
+/* The buffer is only ever bound here for mapping, on a target nothing else
+   uses, so streaming never disturbs the array or uniform buffer bindings.
+   Bindings go through gl_state.h, which elides the rebinds of the same
+   buffer between allocations. */
+const GLenum STREAM_TARGET = GL_COPY_WRITE_BUFFER;
+
+const GLbitfield PERSISTENT_FLAGS = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+static void allocateStorage (StreamBuffer& stream)
+{
+  GLsizeiptr total = stream.RegionSize * STREAM_REGIONS;
+  glGenBuffers (1, &stream.Buffer);
+  bindBuffer (STREAM_TARGET, stream.Buffer);
+  if (stream.Persistent) {
+    glBufferStorage (STREAM_TARGET, total, NULL, PERSISTENT_FLAGS);
+    stream.Mapped = (unsigned char*)glMapBufferRange (STREAM_TARGET, 0, total, PERSISTENT_FLAGS);
+  }
+  else
+    glBufferData (STREAM_TARGET, total, NULL, GL_STREAM_DRAW);
+  stream.Region = 0;
+  stream.Used = 0;
+  int i;
+  for (i=0;i<STREAM_REGIONS;i++)
+    stream.Fences[i] = 0;
+}
+
+static void releaseStorage (StreamBuffer& stream)
+{
+  int i;
+  for (i=0;i<STREAM_REGIONS;i++)
+    if (stream.Fences[i])
+      glDeleteSync (stream.Fences[i]);
+  if (stream.Mapped) {
+    bindBuffer (STREAM_TARGET, stream.Buffer);
+    glUnmapBuffer (STREAM_TARGET);
+    stream.Mapped = NULL;
+  }
+  // Draws already submitted keep the old storage alive until they finish.
+  // The name may come back from glGenBuffers, unbound.
+  forgetBuffer (stream.Buffer);
+  glDeleteBuffers (1, &stream.Buffer);
+  stream.Buffer = 0;
+}
+
+void createStreamBuffer (StreamBuffer& stream, GLsizeiptr region_size)
+{
+  // Keep every region start aligned for any use, uniform ranges included
+  stream.RegionSize = (region_size + 255) & ~(GLsizeiptr)255;
+  stream.Persistent = GLAD_GL_VERSION_4_4 || GLAD_GL_ARB_buffer_storage;
+  stream.Mapped = NULL;
+  stream.Pending = false;
+  stream.Orphans = 0;
+  stream.Waits = 0;
+  allocateStorage(stream);
+  if (stream.Persistent && !stream.Mapped) {
+    // Advertised but unusable: fall back to the GL 3.3 path
+    fprintf(stderr, "stream buffer: persistent mapping failed, using glMapBufferRange\n");
+    releaseStorage(stream);
+    stream.Persistent = false;
+    allocateStorage(stream);
+  }
+}
+
+void deleteStreamBuffer (StreamBuffer& stream)
+{
+  streamCommit(stream);
+  releaseStorage(stream);
+}
+
+void* streamAlloc (StreamBuffer& stream, GLsizeiptr size, GLsizeiptr alignment, GLintptr* offset)
+{
+  streamCommit(stream);
+  GLsizeiptr start = (stream.Used + alignment - 1) & ~(alignment - 1);
+  if (start + size > stream.RegionSize) {
+    // Too much data for one frame: reallocate with room for it and restart
+    // at region 0, which the fresh storage has no fence on
+    GLsizeiptr region_size = stream.RegionSize;
+    while (region_size < start + size)
+      region_size *= 2;
+    releaseStorage(stream);
+    stream.RegionSize = region_size;
+    allocateStorage(stream);
+    start = 0;
+  }
+  stream.Used = start + size;
+  *offset = stream.Region * stream.RegionSize + start;
+  if (stream.Persistent)
+    return stream.Mapped + *offset;
+
+  // The fence check in streamEndFrame() already made sure the GPU is done
+  // with this region, so the driver need not synchronize
+  bindBuffer (STREAM_TARGET, stream.Buffer);
+  void* data = glMapBufferRange (STREAM_TARGET, *offset, size,
+                                 GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+  stream.Pending = true;
+  return data;
+}
+
+void streamCommit (StreamBuffer& stream)
+{
+  // Persistent coherent writes are visible to the GPU without any call
+  if (!stream.Pending)
+    return;
+  bindBuffer (STREAM_TARGET, stream.Buffer);
+  glUnmapBuffer (STREAM_TARGET);
+  stream.Pending = false;
+}
+
+void streamEndFrame (StreamBuffer& stream)
+{
+  streamCommit(stream);
+  if (stream.Used > 0) {
+    stream.Fences[stream.Region] = glFenceSync (GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    stream.Region = (stream.Region + 1) % STREAM_REGIONS;
+    stream.Used = 0;
+  }
+
+  GLsync& fence = stream.Fences[stream.Region];
+  if (!fence)
+    return;
+  // Usually signaled long ago: the GPU is rarely two frames behind
+  GLenum status = glClientWaitSync (fence, 0, 0);
+  if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+    if (stream.Persistent) {
+      // The mapping cannot be swapped out from under the GPU, so wait
+      stream.Waits++;
+      GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+      do {
+        status = glClientWaitSync (fence, flags, 1000000);
+        flags = 0;
+      } while (status == GL_TIMEOUT_EXPIRED);
+    }
+    else {
+      // Orphan: the driver hands out fresh storage and frees the old one
+      // once the GPU is done, so no region is busy any more
+      stream.Orphans++;
+      bindBuffer (STREAM_TARGET, stream.Buffer);
+      glBufferData (STREAM_TARGET, stream.RegionSize * STREAM_REGIONS, NULL, GL_STREAM_DRAW);
+      int i;
+      for (i=0;i<STREAM_REGIONS;i++)
+        if (stream.Fences[i]) {
+          glDeleteSync (stream.Fences[i]);
+          stream.Fences[i] = 0;
+        }
+      return;
+    }
+  }
+  glDeleteSync (fence);
+  fence = 0;
+}
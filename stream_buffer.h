@@ -0,0 +1,50 @@
+#ifndef STREAM_BUFFER_H
+#define STREAM_BUFFER_H
+
+#include <glad/glad.h>
+
+/* One buffer for all data rewritten every frame (instance data, per-object
+   transforms, dynamic geometry). It is split into STREAM_REGIONS regions
+   used round robin, one per frame, and each region is guarded by a fence
+   so the CPU never writes memory the GPU may still be reading.
+
+   With GL 4.4 / ARB_buffer_storage the buffer is allocated once and stays
+   persistently mapped (coherent), so streaming is a plain memcpy. On GL 3.3
+   each allocation maps its range with glMapBufferRange(UNSYNCHRONIZED); if
+   the GPU is still using the next region the whole buffer is orphaned
+   instead of waiting on it. */
+
+const int STREAM_REGIONS = 3;
+
+struct StreamBuffer {
+  GLuint Buffer;
+  GLsizeiptr RegionSize;
+  int Region;                      // region written this frame
+  GLsizeiptr Used;                 // bytes of it handed out so far
+  GLsync Fences[STREAM_REGIONS];   // 0 when the region is known to be free
+  bool Persistent;
+  unsigned char* Mapped;           // whole buffer on the persistent path
+  bool Pending;                    // GL 3.3 path: a range is mapped
+  int Orphans;                     // GL 3.3 path: times the GPU was too far behind
+  int Waits;                       // persistent path: times a fence had to be waited on
+};
+typedef struct StreamBuffer StreamBuffer;
+
+/* Call once the GL context is current */
+void createStreamBuffer (StreamBuffer& stream, GLsizeiptr region_size);
+void deleteStreamBuffer (StreamBuffer& stream);
+
+/* Reserve 'size' bytes of this frame's region at an offset that is a
+   multiple of 'alignment' (a power of two). Returns where to write them and
+   stores their offset in the buffer in *offset. The region grows (the buffer
+   is reallocated) when it cannot hold a frame's data; data handed out
+   earlier stays valid for the draws that already use it. */
+void* streamAlloc (StreamBuffer& stream, GLsizeiptr size, GLsizeiptr alignment, GLintptr* offset);
+/* Finish writing the last allocation, before any draw reads it */
+void streamCommit (StreamBuffer& stream);
+
+/* Fence the frame's region and move to the next one. Call after the last
+   draw of a frame. */
+void streamEndFrame (StreamBuffer& stream);
+
+#endif